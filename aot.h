@@ -0,0 +1,10 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include "core.h"
+
+/* Provided by a C file generated with lc3c */
+void aot_load(VM *vm);
+int aot_run(VM *vm);
+
+#endif
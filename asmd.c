@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "asmd.h"
+
+void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+           p[3];
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    ssize_t n;
+
+    while (len)
+    {
+        n = read(fd, p, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    ssize_t n;
+
+    while (len)
+    {
+        n = write(fd, p, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Read one frame into *data, which is grown to fit and NUL terminated.
+ * Returns its type, or -1 at the end of the stream or on a bad frame. */
+int frame_read(int fd, uint8_t **data, size_t *len)
+{
+    uint8_t hdr[5], *p;
+
+    if (read_all(fd, hdr, sizeof(hdr)) == -1)
+        return -1;
+    *len = get32(hdr);
+    if (*len > ASMD_MAXFRAME)
+        return -1;
+
+    p = realloc(*data, *len + 1);
+    if (!p)
+        return -1;
+    *data = p;
+    if (read_all(fd, p, *len) == -1)
+        return -1;
+    p[*len] = '\0';
+    return hdr[4];
+}
+
+int frame_write(int fd, int type, const void *data, size_t len)
+{
+    uint8_t hdr[5];
+
+    put32(hdr, len);
+    hdr[4] = type;
+    if (write_all(fd, hdr, sizeof(hdr)) == -1)
+        return -1;
+    return write_all(fd, data, len);
+}
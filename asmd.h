@@ -0,0 +1,30 @@
+#ifndef ASMD_H
+#define ASMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Where lcasd listens unless told otherwise */
+#define ASMD_SOCKET "/tmp/lcasd.sock"
+
+/* Every message is a frame: the payload length as four bytes, most
+ * significant first, a type byte, then the payload. Requests carry source
+ * text or a library name. An object reply carries the object's length in
+ * the same four byte form, the object, then the symbol map; an error reply
+ * carries the diagnostic. */
+enum
+{
+    ASMD_ASM = 'A', /* assemble the source in the payload */
+    ASMD_LIB = 'L', /* send the resident library named in the payload */
+    ASMD_OBJ = 'O',
+    ASMD_ERR = 'E',
+};
+
+#define ASMD_MAXFRAME (1 << 20)
+
+int frame_read(int fd, uint8_t **data, size_t *len);
+int frame_write(int fd, int type, const void *data, size_t len);
+void put32(uint8_t *p, uint32_t v);
+uint32_t get32(const uint8_t *p);
+
+#endif
@@ -0,0 +1,128 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "lockstep.h"
+
+/* Shared by the workers of one batch_run() */
+typedef struct batch_s
+{
+    const VM *tmpl;
+    job_t *jobs;
+    int njobs;
+    int next;
+    uint64_t budget;
+    pthread_mutex_t lock;
+} batch_t;
+
+/* Run a clone of the template on each job until none are left. Coverage
+ * is collected per worker and merged into the template's at the end, so
+ * workers never write the same bitmap. */
+static void *worker(void *arg)
+{
+    batch_t *b = arg;
+    job_t *job;
+    VM *vm = malloc(sizeof(*vm)), tmpl = *b->tmpl;
+    int i, n = b->tmpl->engine == ENG_LOCKSTEP ? LS_LANES : 1;
+
+    if (tmpl.cov)
+        tmpl.cov = calloc(1, sizeof(*tmpl.cov));
+    if (!vm || (b->tmpl->cov && !tmpl.cov))
+    {
+        free(vm);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&b->lock);
+        i = b->next;
+        b->next += n;
+        pthread_mutex_unlock(&b->lock);
+        if (i >= b->njobs)
+            break;
+
+        /* The lockstep engine takes a whole group of jobs */
+        if (n > 1)
+        {
+            lockstep_run(&tmpl, b->jobs + i,
+                         b->njobs - i < n ? b->njobs - i : n, b->budget);
+            continue;
+        }
+
+        job = &b->jobs[i];
+        vm_clone(vm, &tmpl);
+        headless(vm, job->in, job->inlen);
+        if (job->want)
+            grade(vm, job->want, job->wantlen);
+        job->status = run(vm, b->budget);
+        job->icount = vm->icount;
+        job->matched = vm->want.pos;
+
+        /* Hand the captured output over to the job */
+        job->out = vm->outbuf;
+        memset(&vm->outbuf, 0, sizeof(vm->outbuf));
+        poweroff(vm);
+    }
+
+    if (tmpl.cov)
+    {
+        pthread_mutex_lock(&b->lock);
+        cov_merge(b->tmpl->cov, tmpl.cov);
+        pthread_mutex_unlock(&b->lock);
+        free(tmpl.cov);
+    }
+    free(vm);
+    return NULL;
+}
+
+/* Run every job on a copy-on-write clone of tmpl, which is booted and
+ * loaded once by the caller, using up to nthreads threads. Returns -1 if
+ * no thread could be started. */
+int batch_run(const VM *tmpl, job_t *jobs, int njobs, uint64_t budget,
+              int nthreads)
+{
+    batch_t b;
+    pthread_t *tid;
+    int i, n = 0;
+
+    b.tmpl = tmpl;
+    b.jobs = jobs;
+    b.njobs = njobs;
+    b.next = 0;
+    b.budget = budget;
+    pthread_mutex_init(&b.lock, NULL);
+
+    for (i = 0; i < njobs; i++)
+    {
+        memset(&jobs[i].out, 0, sizeof(jobs[i].out));
+        jobs[i].status = VM_BUDGET;
+        jobs[i].icount = 0;
+        jobs[i].nlock = 0;
+        jobs[i].matched = 0;
+    }
+
+    if (nthreads > njobs)
+        nthreads = njobs;
+    tid = malloc(nthreads * sizeof(*tid));
+    for (i = 0; tid && i < nthreads; i++)
+        if (pthread_create(&tid[n], NULL, worker, &b) == 0)
+            n++;
+    for (i = 0; i < n; i++)
+        pthread_join(tid[i], NULL);
+
+    free(tid);
+    pthread_mutex_destroy(&b.lock);
+    return n || !njobs ? 0 : -1;
+}
+
+void batch_free(job_t *jobs, int njobs)
+{
+    int i;
+
+    for (i = 0; i < njobs; i++)
+        free(jobs[i].out.data);
+}
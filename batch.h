@@ -0,0 +1,26 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+
+#include "core.h"
+
+/* One run of a program against one scripted input */
+typedef struct job_s
+{
+    const uint8_t *in;
+    size_t inlen;
+    const uint8_t *want; /* expected output to grade against, or NULL */
+    size_t wantlen;
+    size_t matched; /* bytes of output that matched want */
+    buf_t out; /* captured display, owned by the job */
+    int status;
+    uint64_t icount;
+    uint64_t nlock; /* of icount, retired in lockstep with other jobs */
+} job_t;
+
+int batch_run(const VM *tmpl, job_t *jobs, int njobs, uint64_t budget,
+              int nthreads);
+void batch_free(job_t *jobs, int njobs);
+
+#endif
@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "core.h"
+
+/* Host cycle counter: perf counters when the kernel allows, else the TSC */
+enum
+{
+    CYC_NONE = 0,
+    CYC_PERF,
+    CYC_TSC,
+};
+
+int cycsrc = CYC_NONE;
+int perffd = -1;
+
+void cycles_open(void)
+{
+#ifdef __linux__
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CPU_CYCLES;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+
+    perffd = syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+    if (perffd != -1)
+    {
+        cycsrc = CYC_PERF;
+        return;
+    }
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    cycsrc = CYC_TSC;
+#endif
+}
+
+uint64_t cycles(void)
+{
+    uint64_t n = 0;
+
+    switch (cycsrc)
+    {
+    case CYC_PERF:
+        if (read(perffd, &n, sizeof(n)) != sizeof(n))
+            n = 0;
+        break;
+#if defined(__x86_64__) || defined(__i386__)
+    case CYC_TSC:
+        n = __rdtsc();
+        break;
+#endif
+    }
+    return n;
+}
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void usage(void)
+{
+    fprintf(stderr,
+            "Usage: lc3bench [-H] [-n runs] [-e interp|fused] <file>...\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int i, j, n, runs = 5, status, quiet = 0, engine = ENG_INTERP;
+    double t, best;
+    uint64_t c, bestc, icount, nout, nfused[NFUSE];
+    size_t pages;
+    FILE *null;
+    VM *vm;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-H") == 0)
+            quiet = 1;
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+            engine = strcmp(argv[++i], "fused") == 0 ? ENG_FUSED : ENG_INTERP;
+        else
+            usage();
+    }
+    if (i == argc || runs < 1)
+        usage();
+
+    vm = malloc(sizeof(*vm));
+    null = fopen("/dev/null", "w");
+    if (!vm || !null)
+    {
+        fprintf(stderr, "lc3bench: out of resources\n");
+        exit(1);
+    }
+
+    cycles_open();
+
+    printf("%-24s %12s %10s %10s %10s %12s %8s\n", "workload", "instrs",
+           "secs", "MIPS", "cyc/instr", "out B/s", "mem KiB");
+
+    for (; i < argc; i++)
+    {
+        best = 0;
+        bestc = 0;
+        icount = nout = pages = 0;
+        status = VM_HALT;
+
+        /* Report the fastest of several runs */
+        for (n = 0; n < runs; n++)
+        {
+            boot(vm);
+            vm->reg[PC] = read_obj(vm, argv[i]);
+            vm->engine = engine;
+            vm->out = null;
+            if (quiet)
+                headless(vm, NULL, 0);
+
+            t = now();
+            c = cycles();
+            status = run(vm, 0);
+            c = cycles() - c;
+            t = now() - t;
+            pages = mem_pages(vm);
+            poweroff(vm);
+
+            if (status != VM_HALT)
+                break;
+            if (n == 0 || t < best)
+            {
+                best = t;
+                bestc = c;
+            }
+            icount = vm->icount;
+            nout = vm->nout;
+            memcpy(nfused, vm->nfused, sizeof(nfused));
+        }
+
+        if (status != VM_HALT)
+        {
+            printf("%-24s %12s\n", argv[i], "exception");
+            continue;
+        }
+
+        printf("%-24s %12llu %10.4f %10.2f ", argv[i],
+               (unsigned long long)icount, best, icount / best / 1e6);
+        if (cycsrc == CYC_NONE)
+            printf("%10s ", "n/a");
+        else
+            printf("%10.2f ", (double)bestc / icount);
+        printf("%12.0f %8.1f\n", nout / best,
+               pages * PAGE_WORDS * sizeof(uint16_t) / 1024.0);
+
+        /* Superinstructions, as a share of all retired instructions */
+        if (engine == ENG_FUSED)
+        {
+            printf("  fused:");
+            for (j = 0; j < NFUSE; j++)
+                printf(" %s %.1f%%", fuse_name[j], 200.0 * nfused[j] / icount);
+            printf("\n");
+        }
+    }
+
+    if (cycsrc == CYC_TSC)
+        printf("\ncycles are TSC reference cycles\n");
+
+    fclose(null);
+    free(vm);
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+;;; Bubble sort of pseudo-random words
+
+			.ORIG	x3000
+			LD		R4, Reps
+
+Again		LEA		R0, Arr			; Fill array, v = 5v + 7
+			LD		R1, Count
+			LD		R2, Seed
+			LD		R5, Mask
+Fill		ADD		R3, R2, R2
+			ADD		R3, R3, R3
+			ADD		R2, R3, R2
+			ADD		R2, R2, #7
+			AND		R3, R2, R5
+			STR		R3, R0, #0
+			ADD		R0, R0, #1
+			ADD		R1, R1, #-1
+			BRp		Fill
+
+			LD		R1, Count		; R1 = passes left
+			ADD		R1, R1, #-1
+Pass		LEA		R0, Arr
+			ADD		R2, R1, #0		; R2 = compares left
+Inner		LDR		R3, R0, #0
+			LDR		R5, R0, #1
+			NOT		R7, R5
+			ADD		R7, R7, #1
+			ADD		R7, R3, R7		; a[j] - a[j + 1]
+			BRnz	NoSwap
+			STR		R5, R0, #0
+			STR		R3, R0, #1
+NoSwap		ADD		R0, R0, #1
+			ADD		R2, R2, #-1
+			BRp		Inner
+			ADD		R1, R1, #-1
+			BRp		Pass
+
+			ADD		R4, R4, #-1
+			BRp		Again
+			HALT
+
+Reps		.FILL	#50
+Count		.FILL	#200
+Seed		.FILL	x1234
+Mask		.FILL	x3FFF
+Arr			.BLKW	#200
+
+			.END
@@ -0,0 +1,43 @@
+;;; Recursive Fibonacci with a stack in R6
+
+			.ORIG	x3000
+			LD		R6, Stack		; Initialize stack pointer
+			LD		R4, Reps
+
+Again		LD		R0, N
+			JSR		Fib
+			ADD		R4, R4, #-1
+			BRp		Again
+			HALT
+
+;;; Fib: R1 <- fib(R0). Preserves R0 and R7, clobbers R2.
+Fib			ADD		R6, R6, #-1		; Push R7
+			STR		R7, R6, #0
+			ADD		R6, R6, #-1		; Push R0
+			STR		R0, R6, #0
+			ADD		R2, R0, #-2		; fib(0) = 0, fib(1) = 1
+			BRzp	Rec
+			ADD		R1, R0, #0
+			BRnzp	Leave
+
+Rec			ADD		R0, R0, #-1		; fib(n - 1)
+			JSR		Fib
+			ADD		R6, R6, #-1		; Push partial result
+			STR		R1, R6, #0
+			ADD		R0, R0, #-1		; fib(n - 2)
+			JSR		Fib
+			LDR		R2, R6, #0		; Pop partial result
+			ADD		R6, R6, #1
+			ADD		R1, R1, R2
+
+Leave		LDR		R0, R6, #0		; Pop R0
+			ADD		R6, R6, #1
+			LDR		R7, R6, #0		; Pop R7
+			ADD		R6, R6, #1
+			RET
+
+Stack		.FILL	xF000
+Reps		.FILL	#20
+N			.FILL	#20
+
+			.END
@@ -0,0 +1,56 @@
+;;; Insertion sort of pseudo-random words
+
+			.ORIG	x3000
+
+Again		LEA		R0, Arr			; Fill array, v = 5v + 7
+			LD		R1, Count
+			LD		R2, Seed
+			LD		R5, Mask
+Fill		ADD		R3, R2, R2
+			ADD		R3, R3, R3
+			ADD		R2, R3, R2
+			ADD		R2, R2, #7
+			AND		R3, R2, R5
+			STR		R3, R0, #0
+			ADD		R0, R0, #1
+			ADD		R1, R1, #-1
+			BRp		Fill
+
+			LEA		R0, Arr			; R0 = &a[i]
+			ADD		R0, R0, #1
+			LD		R1, Count		; R1 = elements left to insert
+			ADD		R1, R1, #-1
+			AND		R4, R4, #0		; R4 = i
+Outer		ADD		R4, R4, #1
+			LDR		R3, R0, #0		; R3 = -key
+			NOT		R3, R3
+			ADD		R3, R3, #1
+			ADD		R2, R0, #-1		; R2 = &a[j]
+			ADD		R6, R4, #0		; R6 = j + 1
+Shift		LDR		R5, R2, #0
+			ADD		R7, R5, R3		; a[j] - key
+			BRnz	Place
+			STR		R5, R2, #1
+			ADD		R2, R2, #-1
+			ADD		R6, R6, #-1
+			BRp		Shift
+Place		NOT		R3, R3
+			ADD		R3, R3, #1
+			STR		R3, R2, #1
+			ADD		R0, R0, #1
+			ADD		R1, R1, #-1
+			BRp		Outer
+
+			LD		R4, Reps
+			ADD		R4, R4, #-1
+			ST		R4, Reps
+			BRp		Again
+			HALT
+
+Reps		.FILL	#50
+Count		.FILL	#200
+Seed		.FILL	x1234
+Mask		.FILL	x3FFF
+Arr			.BLKW	#200
+
+			.END
@@ -0,0 +1,40 @@
+;;; Unrolled block copy
+
+			.ORIG	x3000
+			LD		R6, Reps
+
+			LEA		R0, Src			; Give the source a pattern
+			LD		R2, Len
+Init		STR		R2, R0, #0
+			ADD		R0, R0, #1
+			ADD		R2, R2, #-1
+			BRp		Init
+
+Again		LEA		R0, Src
+			LD		R2, Len
+			ADD		R1, R0, R2		; R1 = Dst
+			LD		R2, Blocks
+Copy		LDR		R3, R0, #0
+			STR		R3, R1, #0
+			LDR		R3, R0, #1
+			STR		R3, R1, #1
+			LDR		R3, R0, #2
+			STR		R3, R1, #2
+			LDR		R3, R0, #3
+			STR		R3, R1, #3
+			ADD		R0, R0, #4
+			ADD		R1, R1, #4
+			ADD		R2, R2, #-1
+			BRp		Copy
+
+			ADD		R6, R6, #-1
+			BRp		Again
+			HALT
+
+Reps		.FILL	#1000
+Len			.FILL	#2048
+Blocks		.FILL	#512
+Src			.BLKW	#2048
+Dst			.BLKW	#2048
+
+			.END
@@ -0,0 +1,15 @@
+;;; String output through PUTS
+
+			.ORIG	x3000
+			LD		R4, Reps
+
+Again		LEA		R0, Msg
+			PUTS
+			ADD		R4, R4, #-1
+			BRp		Again
+			HALT
+
+Reps		.FILL	#20000
+Msg			.STRINGZ "0123456789abcdef\n"
+
+			.END
@@ -0,0 +1,49 @@
+;;; Sieve of Eratosthenes
+
+			.ORIG	x3000
+			LD		R6, Reps
+			LD		R5, NSize		; R5 = -Size
+
+Again		LEA		R0, Flags		; Clear flags
+			LD		R1, Size
+			AND		R2, R2, #0
+Clear		STR		R2, R0, #0
+			ADD		R0, R0, #1
+			ADD		R1, R1, #-1
+			BRp		Clear
+
+			AND		R1, R1, #0		; R1 = i
+			ADD		R1, R1, #2
+			AND		R4, R4, #0		; R4 = primes found
+Next		ADD		R7, R1, R5
+			BRzp	Fin
+			LEA		R0, Flags
+			ADD		R0, R0, R1
+			LDR		R2, R0, #0
+			BRnp	Skip
+			ADD		R4, R4, #1
+			ADD		R0, R0, R1		; R0 = &flags[2i]
+			ADD		R3, R1, R1		; R3 = 2i - Size
+			ADD		R3, R3, R5
+			BRzp	Skip
+			AND		R2, R2, #0
+			ADD		R2, R2, #1
+Mark		STR		R2, R0, #0
+			ADD		R0, R0, R1
+			ADD		R3, R3, R1
+			BRn		Mark
+Skip		ADD		R1, R1, #1
+			BRnzp	Next
+
+Fin			ST		R4, Primes
+			ADD		R6, R6, #-1
+			BRp		Again
+			HALT
+
+Reps		.FILL	#100
+Size		.FILL	#4000
+NSize		.FILL	#-4000
+Primes		.BLKW	#1
+Flags		.BLKW	#4000
+
+			.END
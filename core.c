@@ -1,104 +1,164 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "core.h"
 #include "op.h"
 
-typedef struct VM
-{
-    uint16_t mem[UINT16_MAX];
-    uint16_t reg[10];
+int obj_order = OBJ_AUTO;
 
-    uint16_t *kbsr;
-    uint16_t *kbdr;
-    uint16_t *dsr;
-    uint16_t *ddr;
-    uint16_t *mcr;
+/* Boot ROM, mapped read-only into every machine and copied on write. The
+ * trap vector table lives in page x00, the trap routines at x0400-x050b and
+ * HALT at xfd70. */
+static uint16_t rom_vec[PAGE_WORDS] = {
+    [GETC] = 0x0400, [OUT] = 0x0430,   [PUTS] = 0x0450,
+    [IN] = 0x04a0,   [PUTSP] = 0x04e0, [HALT] = 0xfd70,
+};
 
-} VM;
+static uint16_t rom_traps[2 * PAGE_WORDS] = {
+    /* GETC */
+    [0x000] =
+        0x3205, 0xa205, 0x7fe, 0xa004, 0x2201, 0xc1c0, 0x0, 0xfe00,
+        0xfe02,
+    /* OUT */
+    [0x030] =
+        0x3205, 0xa205, 0x7fe, 0xb004, 0x2201, 0xc1c0, 0x0, 0xfe04,
+        0xfe06,
+    /* PUTS */
+    [0x050] =
+        0x3e12, 0x3012, 0x3212, 0x3412, 0x6200, 0x405, 0xa409, 0x7fe,
+        0xb208, 0x1021, 0xff9, 0x2008, 0x2208, 0x2408, 0x2e04, 0xc1c0,
+        0xfe04, 0xfe06, 0xa, 0x0, 0x0, 0x0, 0x0,
+    /* IN */
+    [0x0a0] =
+        0x3e0b, 0x300b, 0x2008, 0xf021, 0xe009, 0xf022, 0xf020, 0xf021,
+        0x2e03, 0x2003, 0xc1c0, 0xa, 0x0, 0x0, 0x49, 0x6e,
+        0x70, 0x75, 0x74, 0x20, 0x61, 0x20, 0x63, 0x68,
+        0x61, 0x72, 0x61, 0x63, 0x74, 0x65, 0x72, 0x3e,
+        0x20, 0x0,
+    /* PUTSP */
+    [0x0e0] =
+        0x3023, 0x3223, 0x3423, 0x3623, 0x3823, 0x3a23, 0x3c23, 0x3e23,
+        0x2819, 0x2a19, 0x6200, 0x40a, 0x5444, 0x5645, 0xac10, 0x7fe,
+        0xb40f, 0xac0d, 0x7fe, 0xb60c, 0x1021, 0xff4, 0x200d, 0x220d,
+        0x240d, 0x260c, 0x280b, 0x2a0d, 0x2c0d, 0x2e0d, 0xc1c0, 0xfe04,
+        0xfe06, 0xa, 0xff00, 0xff, 0x0, 0x0, 0x0, 0x0,
+        0x0, 0x0, 0x0, 0x0,
+};
 
-/* Registers */
-enum
-{
-    R0 = 0,
-    R1,
-    R2,
-    R3,
-    R4,
-    R5,
-    R6,
-    R7,
-    PC,
-    PSR,
+static uint16_t rom_halt[PAGE_WORDS] = {
+    [0x70] =
+        0x3e12, 0x3012, 0x3212, 0x2012, 0xf021, 0xe011, 0xf022, 0xa209,
+        0x2009, 0x5040, 0xb006, 0x200a, 0xf021, 0x2e05, 0x2005, 0x2205,
+        0xc1c0, 0xfffe, 0x7fff, 0x0, 0x0, 0x0, 0xa, 0x2d,
+        0x2d, 0x2d, 0x20, 0x48, 0x61, 0x6c, 0x74, 0x69,
+        0x6e, 0x67, 0x20, 0x74, 0x68, 0x65, 0x20, 0x70,
+        0x72, 0x6f, 0x63, 0x65, 0x73, 0x73, 0x6f, 0x72,
+        0x2e, 0x20, 0x2d, 0x2d, 0x2d, 0x0a, 0x0,
 };
 
-void boot(VM *vm);
+/* Backing for pages nothing has written to */
+static uint16_t zero_page[PAGE_WORDS];
 
-uint16_t mem_read(VM *vm, uint16_t loc);
-void mem_write(VM *vm, uint16_t loc, uint16_t val);
+/* Opcodes that end a basic block */
+#define BLOCK_END                                                              \
+    ((1 << BR) | (1 << JMP) | (1 << JSR) | (1 << RTI) | (1 << TRAP))
 
-uint16_t read_obj(VM *vm, const char *path);
-uint16_t read_obj_file(VM *vm, FILE *file);
-uint16_t sext(uint16_t x, uint16_t nbits);
-void setcc(VM *vm, uint16_t r);
+/* Instructions between host polls for pending interrupts */
+#define POLL_INTERVAL 256
 
-/* Trap routines */
-uint16_t tr_getc[] = {0x3205, 0xa205, 0x7fe,  0xa004, 0x2201,
-                      0xc1c0, 0x0,    0xfe00, 0xfe02};
+/* Opcodes whose transfers are recorded as coverage edges */
+#define COV_XFER ((1 << BR) | (1 << JMP) | (1 << JSR))
 
-uint16_t tr_out[] = {0x3205, 0xa205, 0x7fe,  0xb004, 0x2201,
-                     0xc1c0, 0x0,    0xfe04, 0xfe06};
+/* Instructions per millisecond of a headless machine's virtual clock */
+#define VCLOCK_RATE 1000
 
-uint16_t tr_puts[] = {0x3e12, 0x3012, 0x3212, 0x3412, 0x6200, 0x405,
-                      0xa409, 0x7fe,  0xb208, 0x1021, 0xff9,  0x2008,
-                      0x2208, 0x2408, 0x2e04, 0xc1c0, 0xfe04, 0xfe06,
-                      0xa,    0x0,    0x0,    0x0,    0x0};
+/* A status register miss repeated from the same PC within this many
+ * instructions is a poll loop */
+#define IDLE_WINDOW 8
 
-uint16_t tr_in[] = {0x3e0b, 0x300b, 0x2008, 0xf021, 0xe009, 0xf022, 0xf020,
-                    0xf021, 0x2e03, 0x2003, 0xc1c0, 0xa,    0x0,    0x0,
-                    0x49,   0x6e,   0x70,   0x75,   0x74,   0x20,   0x61,
-                    0x20,   0x63,   0x68,   0x61,   0x72,   0x61,   0x63,
-                    0x74,   0x65,   0x72,   0x3e,   0x20,   0x0};
+static int except(VM *vm, uint16_t vect, int pl);
+static void interrupt(VM *vm);
+static uint16_t pop(VM *vm);
+static uint64_t host_ms(void);
+static void flagged_write(VM *vm, uint16_t loc, uint16_t val);
+static int interp(VM *vm);
+static uint16_t mem_swap(VM *vm, uint16_t loc, uint16_t val);
+static void watch_check(VM *vm, uint16_t loc);
+static void pmc_count(VM *vm, uint16_t instr);
+static int run_fused(VM *vm);
+static void bcache_flush(VM *vm);
+static uint16_t *page_own(VM *vm, int p);
+static uint64_t clock_ms(VM *vm);
 
-uint16_t tr_putsp[] = {
-    0x3023, 0x3223, 0x3423, 0x3623, 0x3823, 0x3a23, 0x3c23, 0x3e23, 0x2819,
-    0x2a19, 0x6200, 0x40a,  0x5444, 0x5645, 0xac10, 0x7fe,  0xb40f, 0xac0d,
-    0x7fe,  0xb60c, 0x1021, 0xff4,  0x200d, 0x220d, 0x240d, 0x260c, 0x280b,
-    0x2a0d, 0x2c0d, 0x2e0d, 0xc1c0, 0xfe04, 0xfe06, 0xa,    0xff00, 0xff,
-    0x0,    0x0,    0x0,    0x0,    0x0,    0x0,    0x0,    0x0};
+/* Execute until the machine halts or, if budget is nonzero, until budget
+ * more instructions have retired. */
+int run(VM *vm, uint64_t budget)
+{
+    int status;
 
-uint16_t tr_halt[] = {0x3e12, 0x3012, 0x3212, 0x2012, 0xf021, 0xe011, 0xf022,
-                      0xa209, 0x2009, 0x5040, 0xb006, 0x200a, 0xf021, 0x2e05,
-                      0x2005, 0x2205, 0xc1c0, 0xfffe, 0x7fff, 0x0,    0x0,
-                      0x0,    0xa,    0x2d,   0x2d,   0x2d,   0x20,   0x48,
-                      0x61,   0x6c,   0x74,   0x69,   0x6e,   0x67,   0x20,
-                      0x74,   0x68,   0x65,   0x20,   0x70,   0x72,   0x6f,
-                      0x63,   0x65,   0x73,   0x73,   0x6f,   0x72,   0x2e,
-                      0x20,   0x2d,   0x2d,   0x2d,   0x0a,   0x0};
+    vm->stop_at = budget ? vm->icount + budget : UINT64_MAX;
+    vm->stop = 0;
 
-int main(int argc, char **argv)
-{
+    /* Traces and watchpoints need to see every instruction */
+    if (vm->engine == ENG_FUSED && !vm->trace && !vm->wmap && !vm->pmon &&
+        !vm->rlog)
+        status = run_fused(vm);
+    else
+        status = interp(vm);
 
-    if (argc != 2)
-        printf("usage: blah blah blah\n");
+    /* Halting short of the expected output is a mismatch too */
+    if (status == VM_HALT && vm->grading && vm->want.pos < vm->want.len)
+        return VM_MISMATCH;
 
-    VM vm;
-    boot(&vm);
+    /* As is halting with input left in a replayed log */
+    if (status == VM_HALT && vm->rlog && vm->rlog->replay &&
+        vm->rlog->pos < vm->rlog->n)
+        return VM_DIVERGED;
+    return status;
+}
 
-    uint16_t baser, cond, dr, flgs, imm5, instr, offset6, op, pcoffset9,
-        pcoffset11, pmode, sr, sr1, sr2, start, trapvect8;
+/* Decode and execute one instruction at a time until vm->stop_at */
+static int interp(VM *vm)
+{
+    uint16_t addr, baser, cond, dr, flgs, imm5, instr, offset6, op, pc,
+        pcoffset9, pcoffset11, sr, sr1, sr2, trapvect8;
 
-    start = read_obj(&vm, argv[1]);
-    vm.reg[PC] = start;
+    /* Untraced runs record into a discarded slot so the handlers below
+     * store unconditionally. */
+    trec_t discard, *tr = &discard;
 
     /* MCR[15] controls the clock. If 1, we run; if none, we're done. */
-    while (*vm.mcr)
+    while (*vm->mcr)
     {
+        /* Budget exhausted, a watchpoint fired or the host asked us to stop */
+        if (vm->icount >= vm->stop_at)
+            return vm->stop ? vm->stop : VM_BUDGET;
+        vm->icount++;
 
-        instr = mem_read(&vm, vm.reg[PC]++);
+        if (vm->trace)
+            tr = &vm->trace->rec[vm->trace->n++ & (TRACE_LEN - 1)];
+        tr->pc = pc = vm->reg[PC];
+        if (vm->cov)
+            COV_SET(vm->cov->addr, pc);
+
+        instr = MEM(vm, vm->reg[PC]);
+        vm->reg[PC]++;
         op = instr >> 12;
 
+        tr->instr = instr;
+        tr->val = 0;
+        tr->addr = 0;
+
+        if (vm->pmon)
+            pmc_count(vm, instr);
+
         switch (op)
         {
         case ADD:
@@ -107,14 +167,15 @@ int main(int argc, char **argv)
             if ((instr >> 5) & 0x1)
             {
                 imm5 = instr & 0x1f;
-                vm.reg[dr] = vm.reg[sr1] + sext(imm5, 5);
+                vm->reg[dr] = vm->reg[sr1] + sext(imm5, 5);
             }
             else
             {
                 sr2 = instr & 0x7;
-                vm.reg[dr] = vm.reg[sr1] + vm.reg[sr2];
+                vm->reg[dr] = vm->reg[sr1] + vm->reg[sr2];
             }
-            setcc(&vm, dr);
+            tr->val = vm->reg[dr];
+            vm->cc = vm->reg[dr];
             break;
         case AND:
             dr = (instr >> 9) & 0x7;
@@ -122,229 +183,2221 @@ int main(int argc, char **argv)
             if ((instr >> 5) & 0x1)
             {
                 imm5 = instr & 0x1f;
-                vm.reg[dr] = vm.reg[sr1] & sext(imm5, 5);
+                vm->reg[dr] = vm->reg[sr1] & sext(imm5, 5);
             }
             else
             {
                 sr2 = instr & 0x7;
-                vm.reg[dr] = vm.reg[sr1] & vm.reg[sr2];
+                vm->reg[dr] = vm->reg[sr1] & vm->reg[sr2];
             }
-            setcc(&vm, dr);
+            tr->val = vm->reg[dr];
+            vm->cc = vm->reg[dr];
             break;
         case BR:
             pcoffset9 = sext(instr & 0x1ff, 9);
-            flgs = vm.reg[PSR] & 0x7;
+            flgs = CC_NZP(vm->cc);
             cond = (instr >> 9) & 0x7;
             if (flgs & cond)
-                vm.reg[PC] += pcoffset9;
+                vm->reg[PC] += pcoffset9;
+            tr->val = vm->reg[PC];
             break;
         case JMP:
             baser = (instr >> 6) & 0x7;
-            vm.reg[PC] = vm.reg[baser];
+            vm->reg[PC] = vm->reg[baser];
+            tr->val = vm->reg[PC];
             break;
         case JSR:
-            vm.reg[R7] = vm.reg[PC];
-            if (instr >> 11)
+            /* JSRR R7 jumps to the old R7 */
+            addr = vm->reg[(instr >> 6) & 0x7];
+            vm->reg[R7] = vm->reg[PC];
+            if ((instr >> 11) & 0x1)
             {
                 pcoffset11 = instr & 0x7ff;
-                vm.reg[PC] += sext(pcoffset11, 11);
+                vm->reg[PC] += sext(pcoffset11, 11);
             }
             else
-            {
-                baser = (instr >> 6) & 0x7;
-                vm.reg[PC] = vm.reg[baser];
-            }
+                vm->reg[PC] = addr;
+            tr->val = vm->reg[PC];
             break;
         case LD:
             pcoffset9 = instr & 0x1ff;
             dr = (instr >> 9) & 0x7;
-            vm.reg[dr] = mem_read(&vm, vm.reg[PC] + sext(pcoffset9, 9));
-            setcc(&vm, dr);
+            addr = vm->reg[PC] + sext(pcoffset9, 9);
+            vm->reg[dr] = mem_read(vm, addr);
+            tr->addr = addr;
+            tr->val = vm->reg[dr];
+            vm->cc = vm->reg[dr];
             break;
         case LDI:
             pcoffset9 = instr & 0x1ff;
             dr = (instr >> 9) & 0x7;
-            vm.reg[dr] =
-                mem_read(&vm, mem_read(&vm, vm.reg[PC] + sext(pcoffset9, 9)));
-            setcc(&vm, dr);
+            addr = mem_read(vm, vm->reg[PC] + sext(pcoffset9, 9));
+            vm->reg[dr] = mem_read(vm, addr);
+            tr->addr = addr;
+            tr->val = vm->reg[dr];
+            vm->cc = vm->reg[dr];
             break;
         case LDR:
             offset6 = instr & 0x3f;
             baser = (instr >> 6) & 0x7;
             dr = (instr >> 9) & 0x7;
-            vm.reg[dr] = mem_read(&vm, vm.reg[baser] + sext(offset6, 6));
-            setcc(&vm, dr);
+            addr = vm->reg[baser] + sext(offset6, 6);
+            vm->reg[dr] = mem_read(vm, addr);
+            tr->addr = addr;
+            tr->val = vm->reg[dr];
+            vm->cc = vm->reg[dr];
             break;
         case LEA:
             pcoffset9 = instr & 0x1ff;
             dr = (instr >> 9) & 0x7;
-            vm.reg[dr] = vm.reg[PC] + sext(pcoffset9, 9);
-            setcc(&vm, dr);
+            vm->reg[dr] = vm->reg[PC] + sext(pcoffset9, 9);
+            tr->val = vm->reg[dr];
+            vm->cc = vm->reg[dr];
             break;
         case NOT:
             sr = (instr >> 6) & 0x7;
             dr = (instr >> 9) & 0x7;
-            vm.reg[dr] = ~vm.reg[sr];
-            setcc(&vm, dr);
+            vm->reg[dr] = ~vm->reg[sr];
+            tr->val = vm->reg[dr];
+            vm->cc = vm->reg[dr];
             break;
         case RTI:
-            pmode = (vm.reg[PSR] >> 15) & 0x0;
-            if (pmode)
+            if (vm->reg[PSR] & PSR_USER)
             {
-                vm.reg[PC] = vm.mem[vm.reg[R6]++]; /* R6 stores SSP */
-                vm.reg[PSR] = vm.mem[vm.reg[R6]++];
+                if (!except(vm, PRIV_VECT, -1))
+                    return VM_PRIV;
+                break;
             }
-            else
+            vm->reg[PC] = pop(vm);
+            psr_write(vm, pop(vm));
+            /* Back to the user stack */
+            if (vm->reg[PSR] & PSR_USER)
             {
-                fprintf(stderr, "privilege mode exception\n");
-                exit(1);
+                vm->saved_ssp = vm->reg[R6];
+                vm->reg[R6] = vm->saved_usp;
             }
+            tr->val = vm->reg[PC];
             break;
         case ST:
             pcoffset9 = sext(instr & 0x1ff, 9);
             sr = (instr >> 9) & 0x7;
-            mem_write(&vm, vm.reg[PC] + pcoffset9, vm.reg[sr]);
+            addr = vm->reg[PC] + pcoffset9;
+            mem_write(vm, addr, vm->reg[sr]);
+            tr->addr = addr;
+            tr->val = vm->reg[sr];
             break;
         case STI:
             pcoffset9 = sext(instr & 0x1ff, 9);
             sr = (instr >> 9) & 0x7;
-            mem_write(&vm, mem_read(&vm, vm.reg[PC] + pcoffset9), vm.reg[sr]);
+            addr = mem_read(vm, vm->reg[PC] + pcoffset9);
+            mem_write(vm, addr, vm->reg[sr]);
+            tr->addr = addr;
+            tr->val = vm->reg[sr];
             break;
         case STR:
             offset6 = instr & 0x3f;
             baser = (instr >> 6) & 0x7;
-            sr = (instr >> 9) & 0x3;
-            mem_write(&vm, vm.reg[baser] + sext(offset6, 6), vm.reg[sr]);
+            sr = (instr >> 9) & 0x7;
+            addr = vm->reg[baser] + sext(offset6, 6);
+            mem_write(vm, addr, vm->reg[sr]);
+            tr->addr = addr;
+            tr->val = vm->reg[sr];
             break;
         case TRAP:
             trapvect8 = instr & 0xff;
             /* Save current PC in R7 */
-            vm.reg[R7] = vm.reg[PC];
+            vm->reg[R7] = vm->reg[PC];
             /* Set PC to memory location TRAP routine */
-            vm.reg[PC] = vm.mem[trapvect8];
+            vm->reg[PC] = MEM(vm, trapvect8);
+            tr->addr = trapvect8;
+            tr->val = vm->reg[PC];
             break;
         default:
-            fprintf(stderr, "illegal opcode exception: \\x%4x\n", op);
-            exit(1);
+            if (instr == BRK_INSTR && vm->nbreak)
+            {
+                vm->reg[PC]--;
+                vm->icount--;
+                return VM_BREAK;
+            }
+            if (!except(vm, ILL_VECT, -1))
+                return VM_ILLEGAL;
         }
+
+        if (vm->cov && ((COV_XFER >> op) & 0x1))
+            COV_SET(vm->cov->edge, COV_EDGE(pc, vm->reg[PC]));
+        if (((BLOCK_END >> op) & 0x1) && vm->ien)
+            interrupt(vm);
     }
 
-    return 0;
+    return VM_HALT;
+}
+
+/* Fused engine. Straight-line code is decoded once into a block of dop_t,
+ * with common adjacent pairs merged into superinstructions, and the block
+ * is cached by its start address. */
+
+/* Guest instructions per block, and cached blocks */
+#define BLK_MAX 32
+#define BLK_SLOTS 1024
+
+/* Decoded instruction kinds */
+enum
+{
+    K_ADD = 0,
+    K_ADDI,
+    K_AND,
+    K_ANDI,
+    K_CLR,
+    K_NOT,
+    K_LEA,
+    K_LD,
+    K_LDI,
+    K_LDR,
+    K_ST,
+    K_STI,
+    K_STR,
+    K_BR,
+    K_JMP,
+    K_JSR,
+    K_JSRR,
+    K_TRAP,
+    K_INTERP, /* K_BR to here transfer control and end the block */
+    /* Superinstructions; the second half is decoded into the next slot */
+    K_ADDI_BR,
+    K_LDR_ADD,
+    K_CLR_ADDI,
+    K_LDI_BR,
+    K_LDR_STR,
+};
+
+/* Decoded instruction. PC-relative forms have their target address in imm,
+ * everything else its sign-extended immediate or offset. */
+typedef struct dop_s
+{
+    uint8_t kind;
+    uint8_t a;    /* DR or SR */
+    uint8_t b;    /* SR1 or BaseR */
+    uint8_t c;    /* SR2 or the BR condition */
+    uint8_t done; /* instructions in the block up to and including this */
+    uint8_t dead; /* its flags are overwritten before anything reads them */
+    uint16_t imm;
+    uint16_t next; /* PC after this instruction */
+} dop_t;
+
+typedef struct blk_s
+{
+    uint32_t gen;
+    uint16_t pc;
+    uint8_t nops;
+    uint8_t ninstr;
+    uint8_t covered; /* ran to the end with coverage on since decoded */
+    dop_t op[BLK_MAX];
+} blk_t;
+
+typedef struct bcache_s
+{
+    blk_t blk[BLK_SLOTS];
+    uint8_t cmap[0x10000 / 8]; /* addresses decoded into some block */
+    uint32_t gen;              /* blocks from older generations are stale */
+    int stale;                 /* set when a store lands on decoded code */
+} bcache_t;
+
+const char *fuse_name[NFUSE] = {"add-br", "ldr-add", "clr-add", "ldi-br",
+                                "ldr-str"};
+
+static void decode_one(dop_t *d, uint16_t addr, uint16_t instr)
+{
+    uint16_t next = addr + 1;
+
+    d->a = (instr >> 9) & 0x7;
+    d->b = (instr >> 6) & 0x7;
+    d->c = instr & 0x7;
+    d->imm = 0;
+    d->next = next;
+
+    switch (instr >> 12)
+    {
+    case ADD:
+        d->kind = (instr >> 5) & 0x1 ? K_ADDI : K_ADD;
+        d->imm = sext(instr & 0x1f, 5);
+        break;
+    case AND:
+        d->kind = (instr >> 5) & 0x1 ? K_ANDI : K_AND;
+        d->imm = sext(instr & 0x1f, 5);
+        if (d->kind == K_ANDI && !d->imm)
+            d->kind = K_CLR;
+        break;
+    case NOT:
+        d->kind = K_NOT;
+        break;
+    case LEA:
+        d->kind = K_LEA;
+        d->imm = next + sext(instr & 0x1ff, 9);
+        break;
+    case LD:
+        d->kind = K_LD;
+        d->imm = next + sext(instr & 0x1ff, 9);
+        break;
+    case LDI:
+        d->kind = K_LDI;
+        d->imm = next + sext(instr & 0x1ff, 9);
+        break;
+    case LDR:
+        d->kind = K_LDR;
+        d->imm = sext(instr & 0x3f, 6);
+        break;
+    case ST:
+        d->kind = K_ST;
+        d->imm = next + sext(instr & 0x1ff, 9);
+        break;
+    case STI:
+        d->kind = K_STI;
+        d->imm = next + sext(instr & 0x1ff, 9);
+        break;
+    case STR:
+        d->kind = K_STR;
+        d->imm = sext(instr & 0x3f, 6);
+        break;
+    case BR:
+        d->kind = K_BR;
+        d->c = (instr >> 9) & 0x7;
+        d->imm = next + sext(instr & 0x1ff, 9);
+        break;
+    case JMP:
+        d->kind = K_JMP;
+        break;
+    case JSR:
+        d->kind = (instr >> 11) & 0x1 ? K_JSR : K_JSRR;
+        d->imm = next + sext(instr & 0x7ff, 11);
+        break;
+    case TRAP:
+        d->kind = K_TRAP;
+        d->imm = instr & 0xff;
+        break;
+    default:
+        /* RTI, illegal opcodes and breakpoints */
+        d->kind = K_INTERP;
+        d->imm = addr;
+    }
+}
+
+/* The superinstruction d followed by d1 makes, or -1 */
+static int fuse(const dop_t *d, const dop_t *d1)
+{
+    switch (d->kind)
+    {
+    case K_ADDI:
+        if (d1->kind == K_BR && d1->c)
+            return K_ADDI_BR;
+        break;
+    case K_LDR:
+        if (d1->kind == K_ADD || d1->kind == K_ADDI)
+            return K_LDR_ADD;
+        if (d1->kind == K_STR)
+            return K_LDR_STR;
+        break;
+    case K_CLR:
+        if (d1->kind == K_ADDI && d1->a == d->a && d1->b == d->a)
+            return K_CLR_ADDI;
+        break;
+    case K_LDI:
+        if (d1->kind == K_BR && d1->c)
+            return K_LDI_BR;
+        break;
+    }
+    return -1;
+}
+
+/* How a decoded instruction uses the flags. Loads count as readers since
+ * one from PSRR reads the PSR, and stores because they may end the block
+ * early. */
+#define CC_READ 0x1
+#define CC_WRITE 0x2
+
+static int cc_use(const dop_t *d)
+{
+    switch (d->kind)
+    {
+    case K_ADD:
+    case K_ADDI:
+    case K_AND:
+    case K_ANDI:
+    case K_CLR:
+    case K_NOT:
+    case K_LEA:
+    case K_ADDI_BR:
+    case K_CLR_ADDI:
+        return CC_WRITE;
+    case K_LD:
+        return d->imm >= DEVPAGE ? CC_READ | CC_WRITE : CC_WRITE;
+    case K_LDI:
+    case K_LDR:
+    case K_LDI_BR:
+    case K_LDR_ADD:
+    case K_LDR_STR:
+        return CC_READ | CC_WRITE;
+    }
+    return CC_READ;
+}
+
+static void code_mark(VM *vm, uint16_t addr)
+{
+    vm->bcache->cmap[addr >> 3] |= 1 << (addr & 0x7);
+    vm->pflags[addr >> 8] |= PF_CODE;
+}
+
+/* Decode the block starting at pc into b */
+static void decode(VM *vm, blk_t *b, uint16_t pc)
+{
+    dop_t *d = b->op;
+    uint16_t addr = pc;
+    int n = 0, kind, use, live;
+
+    b->gen = vm->bcache->gen;
+    b->pc = pc;
+    b->covered = 0;
+    while (n < BLK_MAX)
+    {
+        /* Code in the device pages is left to the interpreter */
+        if (vm->pflags[addr >> 8] & PF_DEV)
+        {
+            d->kind = K_INTERP;
+            d->imm = addr;
+            d->next = addr;
+            d->done = n;
+            d++;
+            break;
+        }
+
+        decode_one(d, addr, MEM(vm, addr));
+        if (d->kind == K_INTERP)
+        {
+            d->done = n;
+            d++;
+            break;
+        }
+        code_mark(vm, addr);
+        n++;
+        addr = d->next;
+
+        if (n < BLK_MAX && !(vm->pflags[addr >> 8] & PF_DEV))
+        {
+            decode_one(d + 1, addr, MEM(vm, addr));
+            kind = fuse(d, d + 1);
+            if (kind != -1)
+            {
+                code_mark(vm, addr);
+                n++;
+                addr = d[1].next;
+                d->kind = kind;
+                d->next = addr;
+                d->done = d[1].done = n;
+                d += 2;
+                if (d[-1].kind == K_BR)
+                    break;
+                continue;
+            }
+        }
+
+        d->done = n;
+        d++;
+        if (d[-1].kind >= K_BR)
+            break;
+    }
+
+    b->nops = d - b->op;
+    b->ninstr = n;
+
+    /* Flags are live at the end of the block */
+    for (live = 1; d-- > b->op;)
+    {
+        use = cc_use(d);
+        d->dead = (use & CC_WRITE) && !live;
+        if (use & CC_WRITE)
+            live = 0;
+        if (use & CC_READ)
+            live = 1;
+    }
+}
+
+/* Forget every decoded block */
+static void bcache_flush(VM *vm)
+{
+    int i;
+
+    if (!vm->bcache)
+        return;
+    vm->bcache->gen++;
+    memset(vm->bcache->cmap, 0, sizeof(vm->bcache->cmap));
+    for (i = 0; i < 256; i++)
+        vm->pflags[i] &= ~PF_CODE;
+    vm->bcache->stale = 1;
+}
+
+/* Store from a block. Returns nonzero if the rest of the block must be
+ * skipped because the machine halted, the store overwrote decoded code or
+ * the host asked us to stop. */
+static int blk_store(VM *vm, uint16_t addr, uint16_t val)
+{
+    if (!vm->pflags[addr >> 8])
+    {
+        MEM(vm, addr) = val;
+        return 0;
+    }
+    flagged_write(vm, addr, val);
+    return !*vm->mcr || vm->bcache->stale || vm->icount >= vm->stop_at ||
+           vm->pmon;
+}
+
+/* Give back the instructions of b after d, which will not run */
+static dop_t *blk_leave(VM *vm, blk_t *b, dop_t *d)
+{
+    vm->icount -= b->ninstr - d->done;
+    return &b->op[b->nops - 1];
+}
+
+/* Mark the n instructions of b that ran, and the transfer that ended it if
+ * it ran to the end. Once a block has run to the end its addresses are
+ * marked, so later runs mark just the edge. An instruction left to the
+ * interpreter marks itself. */
+static void cov_block(VM *vm, blk_t *b, uint64_t n)
+{
+    const dop_t *last = &b->op[b->nops - 1];
+    uint16_t addr = b->pc;
+
+    if (n >= b->ninstr)
+    {
+        if (last->kind >= K_BR && last->kind <= K_JSRR)
+            COV_SET(vm->cov->edge, COV_EDGE(last->next - 1, vm->reg[PC]));
+        if (b->covered)
+            return;
+        b->covered = 1;
+        n = b->ninstr;
+    }
+    for (; n; n--, addr++)
+        COV_SET(vm->cov->addr, addr);
+}
+
+/* Interpret the one instruction at PC */
+static int interp_one(VM *vm)
+{
+    uint64_t stop_at = vm->stop_at;
+    int status;
+
+    vm->stop_at = vm->icount + 1;
+    status = interp(vm);
+    if (!vm->stop)
+        vm->stop_at = stop_at;
+    return status;
+}
+
+static int run_fused(VM *vm)
+{
+    uint16_t *reg = vm->reg, addr;
+    bcache_t *bc = vm->bcache;
+    uint32_t discard, *cc[2] = {&vm->cc, &discard};
+    blk_t *b;
+    dop_t *d, *end;
+    uint64_t start;
+    int status;
+
+    /* Generation 0 marks the empty slots */
+    if (!bc)
+    {
+        bc = vm->bcache = calloc(1, sizeof(*bc));
+        if (!bc)
+            return interp(vm);
+        bc->gen = 1;
+    }
+
+    while (*vm->mcr)
+    {
+        if (vm->icount >= vm->stop_at)
+            return vm->stop ? vm->stop : VM_BUDGET;
+
+        /* Counting is left to the interpreter */
+        if (vm->pmon)
+            return interp(vm);
+
+        /* A block must not overrun the budget, so finish one at a time */
+        if (vm->stop_at - vm->icount <= BLK_MAX)
+        {
+            status = interp_one(vm);
+            if (status != VM_BUDGET)
+                return status;
+            continue;
+        }
+
+        b = &bc->blk[reg[PC] & (BLK_SLOTS - 1)];
+        if (b->gen != bc->gen || b->pc != reg[PC])
+            decode(vm, b, reg[PC]);
+        bc->stale = 0;
+        start = vm->icount;
+        vm->icount += b->ninstr;
+
+        for (d = b->op, end = d + b->nops; d < end; d++)
+        {
+            reg[PC] = d->next;
+
+            switch (d->kind)
+            {
+            case K_ADD:
+                reg[d->a] = reg[d->b] + reg[d->c];
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_ADDI:
+                reg[d->a] = reg[d->b] + d->imm;
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_AND:
+                reg[d->a] = reg[d->b] & reg[d->c];
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_ANDI:
+                reg[d->a] = reg[d->b] & d->imm;
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_CLR:
+                reg[d->a] = 0;
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_NOT:
+                reg[d->a] = ~reg[d->b];
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_LEA:
+                reg[d->a] = d->imm;
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_LD:
+                reg[d->a] = mem_read(vm, d->imm);
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_LDI:
+                reg[d->a] = mem_read(vm, mem_read(vm, d->imm));
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_LDR:
+                reg[d->a] = mem_read(vm, reg[d->b] + d->imm);
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_ST:
+                if (blk_store(vm, d->imm, reg[d->a]))
+                    d = blk_leave(vm, b, d);
+                break;
+            case K_STI:
+                if (blk_store(vm, mem_read(vm, d->imm), reg[d->a]))
+                    d = blk_leave(vm, b, d);
+                break;
+            case K_STR:
+                if (blk_store(vm, reg[d->b] + d->imm, reg[d->a]))
+                    d = blk_leave(vm, b, d);
+                break;
+            case K_BR:
+                if (CC_NZP(vm->cc) & d->c)
+                    reg[PC] = d->imm;
+                break;
+            case K_JMP:
+                reg[PC] = reg[d->b];
+                break;
+            case K_JSR:
+                reg[R7] = reg[PC];
+                reg[PC] = d->imm;
+                break;
+            case K_JSRR:
+                addr = reg[d->b];
+                reg[R7] = reg[PC];
+                reg[PC] = addr;
+                break;
+            case K_TRAP:
+                reg[R7] = reg[PC];
+                reg[PC] = MEM(vm, d->imm);
+                break;
+            case K_INTERP:
+                reg[PC] = d->imm;
+                status = interp_one(vm);
+                if (status == VM_BUDGET)
+                    break;
+                if (vm->cov)
+                    cov_block(vm, b, d->done);
+                return status;
+
+            /* Each fused handler runs both halves. The flags of the first
+             * half are dead wherever the second sets its own. */
+            case K_ADDI_BR:
+                vm->nfused[F_ADDI_BR]++;
+                reg[d->a] = reg[d->b] + d->imm;
+                *cc[d->dead] = reg[d->a];
+                d++;
+                if (CC_NZP(vm->cc) & d->c)
+                    reg[PC] = d->imm;
+                break;
+            case K_LDR_ADD:
+                vm->nfused[F_LDR_ADD]++;
+                reg[d->a] = mem_read(vm, reg[d->b] + d->imm);
+                d++;
+                reg[d->a] =
+                    reg[d->b] + (d->kind == K_ADDI ? d->imm : reg[d->c]);
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_CLR_ADDI:
+                vm->nfused[F_CLR_ADDI]++;
+                d++;
+                reg[d->a] = d->imm;
+                *cc[d->dead] = reg[d->a];
+                break;
+            case K_LDI_BR:
+                vm->nfused[F_LDI_BR]++;
+                reg[d->a] = mem_read(vm, mem_read(vm, d->imm));
+                *cc[d->dead] = reg[d->a];
+                d++;
+                if (CC_NZP(vm->cc) & d->c)
+                    reg[PC] = d->imm;
+                break;
+            case K_LDR_STR:
+                vm->nfused[F_LDR_STR]++;
+                reg[d->a] = mem_read(vm, reg[d->b] + d->imm);
+                *cc[d->dead] = reg[d->a];
+                d++;
+                if (blk_store(vm, reg[d->b] + d->imm, reg[d->a]))
+                    d = blk_leave(vm, b, d);
+                break;
+            }
+        }
+
+        if (vm->cov)
+            cov_block(vm, b, vm->icount - start);
+        if (vm->ien)
+            interrupt(vm);
+    }
+
+    return VM_HALT;
+}
+
+/* Point the device register shortcuts into the device pages */
+static void dev_map(VM *vm)
+{
+    vm->kbsr = &MEM(vm, KBSR);
+    vm->kbdr = &MEM(vm, KBDR);
+    vm->dsr = &MEM(vm, DSR);
+    vm->ddr = &MEM(vm, DDR);
+    vm->tmr = &MEM(vm, TMR);
+    vm->tmi = &MEM(vm, TMI);
+    vm->ipir = &MEM(vm, IPIR);
+    vm->mcr = &MEM(vm, MCR);
 }
 
 void boot(VM *vm)
 {
-    /* Zero out memory */
-    memset(vm->mem, 0, sizeof(vm->mem));
+    int i;
+
+    /* Map the boot ROM and leave everything else on the zero page; memory
+     * is only allocated once it is written */
+    for (i = 0; i < NPAGES; i++)
+    {
+        vm->page[i] = zero_page;
+        vm->pown[i] = 0;
+        vm->pflags[i] = PF_COW;
+    }
+    vm->page[0x00] = rom_vec;
+    vm->page[0x04] = rom_traps;
+    vm->page[0x05] = rom_traps + PAGE_WORDS;
+    vm->page[0xfd] = rom_halt;
+
+    memset(vm->reg, 0, sizeof(vm->reg));
+    psr_write(vm, PSR_USER | 0x2);
+    vm->saved_ssp = 0x3000;
+    vm->saved_usp = 0;
+    vm->poll_at = 0;
+    vm->ien = 0;
+    vm->epoch = host_ms();
+    vm->vskew = 0;
+    vm->tmr_next = 0;
+    vm->idle_pc = 0;
+    vm->idle_at = 0;
+    vm->nidle = 0;
+
+    vm->infd = STDIN_FILENO;
+    vm->out = stdout;
+    vm->kbeof = 0;
+    vm->headless = 0;
+    memset(&vm->inbuf, 0, sizeof(vm->inbuf));
+    memset(&vm->outbuf, 0, sizeof(vm->outbuf));
+    vm->grading = 0;
+    memset(&vm->want, 0, sizeof(vm->want));
+    vm->icount = 0;
+    vm->nout = 0;
+    vm->pmon = 0;
+    memset(vm->pmc, 0, sizeof(vm->pmc));
+    vm->hartid = 0;
+    vm->nharts = 1;
+    vm->harts = NULL;
+    vm->ipi = 0;
+    vm->trace = NULL;
+    vm->cov = NULL;
+    vm->rlog = NULL;
+    vm->nbreak = 0;
+    vm->wmap = NULL;
+    vm->stop = 0;
+    vm->stop_at = UINT64_MAX;
+    vm->engine = ENG_INTERP;
+    vm->bcache = NULL;
+    memset(vm->nfused, 0, sizeof(vm->nfused));
+
+    /* Device registers live in the top two pages, which are private */
+    page_own(vm, DEVPAGE >> 8);
+    page_own(vm, 0xff);
+    vm->pflags[DEVPAGE >> 8] = PF_DEV;
+    vm->pflags[0xff] = PF_DEV;
+
+    dev_map(vm);
 
     /* KBSR - Keyboard Status Register */
-    vm->kbsr = &vm->mem[0xfe00];
     *vm->kbsr = 0x8000;
 
     /* KBDR - Keyboard Data Register */
-    vm->kbdr = &vm->mem[0xfe02];
     *vm->kbdr = 0x0;
 
     /* DSR - Display Status Register */
-    vm->dsr = &vm->mem[0xfe04];
     *vm->dsr = 0x8000;
 
     /* DDR - Display Data Register */
-    vm->ddr = &vm->mem[0xfe06];
     *vm->ddr = 0x0;
 
+    /* TMR - Timer Status Register */
+    *vm->tmr = 0x0;
+
+    /* TMI - Timer Interval Register, in milliseconds; 0 stops the timer */
+    *vm->tmi = 0x0;
+
     /* MCR - Machine Control Register */
-    vm->mcr = &vm->mem[0xfffe];
     *vm->mcr = 0x8000;
 
-    /* Trap table */
-    vm->mem[GETC] = 0x0400;
-    vm->mem[OUT] = 0x0430;
-    vm->mem[PUTS] = 0x0450;
-    vm->mem[IN] = 0x04a0;
-    vm->mem[PUTSP] = 0x04e0;
-    vm->mem[HALT] = 0xfd70;
+    /* PMCR - Performance Counter Control Register; counters start stopped */
+    MEM(vm, PMCR) = 0x0;
 
-    /* Load trap routines */
-    memcpy(&vm->mem[0x0400], &tr_getc, sizeof(tr_getc));
-    memcpy(&vm->mem[0x0430], &tr_out, sizeof(tr_out));
-    memcpy(&vm->mem[0x0450], &tr_puts, sizeof(tr_puts));
-    memcpy(&vm->mem[0x04a0], &tr_in, sizeof(tr_in));
-    memcpy(&vm->mem[0x04e0], &tr_putsp, sizeof(tr_putsp));
-    memcpy(&vm->mem[0xfd70], &tr_halt, sizeof(tr_halt));
+    /* IPIR - Inter-Processor Interrupt Register */
+    *vm->ipir = 0x0;
 }
 
-uint16_t mem_read(VM *vm, uint16_t loc)
+/* Make dst a copy-on-write clone of src, a booted and loaded machine that
+ * is not running. Only the device pages are copied up front. src must not
+ * run again until its clones are powered off, and must outlive them. */
+void vm_clone(VM *dst, const VM *src)
 {
-    /* If reading from KBDR, get char from keyboard */
-    if (&vm->mem[loc] == vm->kbdr)
+    int i;
+
+    *dst = *src;
+    for (i = 0; i < NPAGES; i++)
     {
-        *vm->kbsr &= 0x7fff;
-        *vm->kbdr = (uint16_t)getc(stdin);
-        *vm->kbsr = 0x8000;
+        dst->pown[i] = 0;
+        dst->pflags[i] = (dst->pflags[i] & ~(PF_CODE | PF_WATCH)) | PF_COW;
     }
-    return vm->mem[loc];
+    page_own(dst, DEVPAGE >> 8);
+    page_own(dst, 0xff);
+    dev_map(dst);
+
+    /* Nothing the host attached to src carries over */
+    dst->bcache = NULL;
+    dst->wmap = NULL;
+    dst->trace = NULL;
+    dst->rlog = NULL;
+    memset(&dst->inbuf, 0, sizeof(dst->inbuf));
+    memset(&dst->outbuf, 0, sizeof(dst->outbuf));
+    memset(dst->nfused, 0, sizeof(dst->nfused));
 }
 
-void mem_write(VM *vm, uint16_t loc, uint16_t val)
+/* Make harts[1..n) further cores of the machine in harts[0], which is
+ * booted and loaded but not running. Every hart starts at the same PC and
+ * shares all memory below the device pages; registers and devices are
+ * private. Each supervisor stack starts a page below the last hart's, and
+ * only hart 0 reads the keyboard. Power off hart 0 last. */
+void smp_boot(VM *harts, int n)
 {
-    /* If writing to DDR, display val on screen */
-    if (&vm->mem[loc] == vm->ddr)
+    VM *vm = harts;
+    int i, p;
+
+    /* Shared pages must not be copied on write */
+    for (p = 0; p < (DEVPAGE >> 8); p++)
+        page_own(vm, p);
+    vm->harts = harts;
+    vm->nharts = n;
+
+    /* A store by one hart would not flush another's decoded blocks */
+    vm->engine = ENG_INTERP;
+
+    for (i = 1; i < n; i++)
     {
-        *vm->dsr &= 0x7fff;
-        putc((char)val, stdout);
-        *vm->dsr = 0x8000;
+        boot(&harts[i]);
+        for (p = 0; p < (DEVPAGE >> 8); p++)
+        {
+            harts[i].page[p] = vm->page[p];
+            harts[i].pown[p] = 0;
+            harts[i].pflags[p] = 0;
+        }
+        harts[i].reg[PC] = vm->reg[PC];
+        harts[i].saved_ssp = vm->saved_ssp - i * PAGE_WORDS;
+        harts[i].out = vm->out;
+        harts[i].infd = -1;
+        harts[i].kbeof = 1;
+        if (vm->headless)
+            headless(&harts[i], NULL, 0);
+        harts[i].hartid = i;
+        harts[i].nharts = n;
+        harts[i].harts = harts;
     }
-    vm->mem[loc] = val;
 }
 
-uint16_t read_obj(VM *vm, const char *path)
+/* Release anything boot() or headless() allocated */
+void poweroff(VM *vm)
 {
-    uint16_t start;
-    FILE *fp = fopen(path, "rb");
-    if (!fp)
+    int i;
+
+    if (vm->inbuf.cap)
+        free(vm->inbuf.data);
+    if (vm->outbuf.cap)
+        free(vm->outbuf.data);
+    memset(&vm->inbuf, 0, sizeof(vm->inbuf));
+    memset(&vm->outbuf, 0, sizeof(vm->outbuf));
+    free(vm->wmap);
+    vm->wmap = NULL;
+    free(vm->bcache);
+    vm->bcache = NULL;
+
+    for (i = 0; i < NPAGES; i++)
     {
-        fprintf(stderr, "unable to open img\n");
-        exit(1);
+        if (vm->pown[i])
+            free(vm->page[i]);
+        vm->page[i] = zero_page;
+        vm->pown[i] = 0;
+        vm->pflags[i] = PF_COW;
     }
-    start = read_obj_file(vm, fp);
+}
 
-    fclose(fp);
+/* Feed the keyboard from in and capture the display. The VM borrows in. */
+void headless(VM *vm, const uint8_t *in, size_t len)
+{
+    vm->headless = 1;
+    vm->inbuf.data = (uint8_t *)in;
+    vm->inbuf.len = len;
+    vm->inbuf.cap = 0;
+    vm->inbuf.pos = 0;
+}
 
-    return start;
+/* Check the display against want as it is written, stopping the machine
+ * at the first byte that differs. The VM borrows want. */
+void grade(VM *vm, const uint8_t *want, size_t len)
+{
+    vm->grading = 1;
+    vm->want.data = (uint8_t *)want;
+    vm->want.len = len;
+    vm->want.cap = 0;
+    vm->want.pos = 0;
 }
 
-uint16_t read_obj_file(VM *vm, FILE *file)
+/* Refill the interactive keyboard buffer, blocking if wait is set */
+static int kbd_fill(VM *vm, int wait)
 {
-    /* First word of file should be origin */
-    uint16_t origin;
-    fread(&origin, sizeof(origin), 1, file);
+    struct pollfd pfd;
+    ssize_t n;
 
-    /* Read the rest of the program */
-    uint16_t max_read, *p;
-    max_read = UINT16_MAX - origin;
-    p = vm->mem + origin;
-    fread(p, sizeof(uint16_t), max_read, file);
+    if (vm->headless || vm->kbeof)
+        return 0;
 
-    return origin;
+    if (!wait)
+    {
+        pfd.fd = vm->infd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 0) != 1)
+            return 0;
+    }
+
+    if (!vm->inbuf.cap)
+    {
+        vm->inbuf.cap = 4096;
+        vm->inbuf.data = malloc(vm->inbuf.cap);
+        if (!vm->inbuf.data)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    /* Anything the program printed or logged should be out before we
+     * block */
+    fflush(vm->out);
+    if (vm->rlog)
+        fflush(vm->rlog->fp);
+    n = read(vm->infd, vm->inbuf.data, vm->inbuf.cap);
+    if (n <= 0)
+    {
+        vm->kbeof = 1;
+        return 0;
+    }
+    vm->inbuf.len = n;
+    vm->inbuf.pos = 0;
+    return 1;
 }
 
-uint16_t sext(uint16_t x, uint16_t nbits)
+/* Whether a keyboard byte is waiting */
+static int kbd_avail(VM *vm)
 {
-    if ((x >> (nbits - 1)) & 1)
-        x |= (0xffff << nbits);
-    return x;
+    return vm->inbuf.pos < vm->inbuf.len || kbd_fill(vm, 0);
 }
 
-void setcc(VM *vm, uint16_t r)
+/* Whether reading KBDR would not block. End of input counts as ready. */
+static int kbd_ready(VM *vm)
+{
+    return kbd_avail(vm) || vm->headless || vm->kbeof;
+}
+
+static uint64_t host_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Milliseconds since boot. Headless machines run on a virtual clock driven
+ * by the instruction count so that runs stay deterministic. */
+static uint64_t clock_ms(VM *vm)
 {
-    vm->reg[PSR] &= 0x0;
-    uint16_t t = vm->reg[r], c;
-    if (t >> 15)
-        c = 0x4;
-    else if (t == 0)
-        c = 0x2;
+    if (vm->headless)
+        return vm->icount / VCLOCK_RATE + vm->vskew;
+    return host_ms() - vm->epoch;
+}
+
+/* Raise TMR[15] if the interval has elapsed */
+static void timer_check(VM *vm)
+{
+    uint64_t now;
+
+    if (!*vm->tmi)
+        return;
+    now = clock_ms(vm);
+    if (now >= vm->tmr_next)
+    {
+        *vm->tmr |= 0x8000;
+        vm->tmr_next = now + *vm->tmi;
+    }
+}
+
+/* Called when a status register read finds its device not ready. The second
+ * miss in a row from the same PC means the guest is spinning on the
+ * register, so instead of burning the host core we park until input arrives
+ * or the timer is due. A headless machine fast-forwards its virtual clock. */
+static void idle(VM *vm)
+{
+    struct pollfd pfd;
+    int timeout = -1;
+    uint64_t now;
+
+    if (vm->reg[PC] != vm->idle_pc || vm->icount - vm->idle_at > IDLE_WINDOW)
+    {
+        vm->idle_pc = vm->reg[PC];
+        vm->idle_at = vm->icount;
+        return;
+    }
+    vm->idle_at = vm->icount;
+    vm->nidle++;
+
+    if (*vm->tmi)
+    {
+        now = clock_ms(vm);
+        timeout = vm->tmr_next > now ? vm->tmr_next - now : 0;
+    }
+
+    if (vm->headless)
+    {
+        if (timeout > 0)
+            vm->vskew += timeout;
+        return;
+    }
+
+    /* Nothing could ever wake us */
+    if (timeout == -1 && (vm->kbeof || vm->inbuf.pos < vm->inbuf.len))
+        return;
+
+    fflush(vm->out);
+    if (vm->rlog)
+        fflush(vm->rlog->fp);
+    pfd.fd = vm->kbeof ? -1 : vm->infd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, timeout);
+}
+
+/* Next keyboard byte, or 0xffff at end of input */
+static uint16_t kbd_getc(VM *vm)
+{
+    if (vm->inbuf.pos == vm->inbuf.len && !kbd_fill(vm, 1))
+        return 0xffff;
+    return vm->inbuf.data[vm->inbuf.pos++];
+}
+
+static void ddr_putc(VM *vm, uint16_t c)
+{
+    /* A wrong byte, or one past the end, stops the run at this store */
+    if (vm->grading)
+    {
+        if (vm->want.pos == vm->want.len ||
+            vm->want.data[vm->want.pos] != (uint8_t)c)
+        {
+            vm->stop = VM_MISMATCH;
+            vm->stop_at = 0;
+        }
+        else
+            vm->want.pos++;
+    }
+
+    if (vm->headless)
+        buf_put(&vm->outbuf, (uint8_t)c);
     else
-        c = 0x1;
-    vm->reg[PSR] |= c;
+        putc((char)c, vm->out);
+    vm->nout++;
+}
+
+/* Push val onto the supervisor stack */
+static void push(VM *vm, uint16_t val)
+{
+    mem_write(vm, --vm->reg[R6], val);
+}
+
+static uint16_t pop(VM *vm)
+{
+    return mem_read(vm, vm->reg[R6]++);
+}
+
+/* Enter the handler for vector vect at priority pl, or at the current
+ * priority if pl is -1. Returns 0 if no handler is installed. */
+static int except(VM *vm, uint16_t vect, int pl)
+{
+    uint16_t psr = psr_read(vm), handler = MEM(vm, IVT + vect);
+
+    if (!handler)
+        return 0;
+
+    /* Switch to the supervisor stack */
+    if (psr & PSR_USER)
+    {
+        vm->saved_usp = vm->reg[R6];
+        vm->reg[R6] = vm->saved_ssp;
+    }
+    push(vm, psr);
+    push(vm, vm->reg[PC]);
+
+    vm->reg[PSR] = psr & ~PSR_USER;
+    if (pl != -1)
+        vm->reg[PSR] = (vm->reg[PSR] & ~PSR_PL) | (pl << 8);
+    vm->reg[PC] = handler;
+    return 1;
+}
+
+/* Stop at the instruction that strayed from the replayed log */
+static void diverged(VM *vm)
+{
+    vm->stop = VM_DIVERGED;
+    vm->stop_at = 0;
+}
+
+static void put_varint(FILE *fp, uint64_t v)
+{
+    for (; v >= 0x80; v >>= 7)
+        putc(0x80 | (v & 0x7f), fp);
+    putc(v, fp);
+}
+
+static int get_varint(FILE *fp, uint64_t *v)
+{
+    int c, shift;
+
+    for (*v = 0, shift = 0; shift < 64; shift += 7)
+    {
+        if ((c = getc(fp)) == EOF)
+            return -1;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+/* Write out the held event: its kind, with bit 7 set if it repeats, the
+ * instructions since the last event, its value and any repeats */
+static void rlog_write(rlog_t *log)
+{
+    revent_t *p = &log->pend;
+
+    if (!log->held)
+        return;
+    putc(p->kind | (p->reps ? 0x80 : 0), log->fp);
+    put_varint(log->fp, p->icount - log->last);
+    putc(p->val & 0xff, log->fp);
+    putc(p->val >> 8, log->fp);
+    if (p->reps)
+    {
+        put_varint(log->fp, p->reps);
+        put_varint(log->fp, p->step);
+    }
+    log->last = p->icount + p->reps * p->step;
+    log->held = 0;
+    log->n++;
+}
+
+/* Log an event. One that repeats the held event at the same pace only
+ * counts another repeat, so a poll loop costs a few bytes however long it
+ * spins. */
+static void rlog_put(VM *vm, int kind, uint16_t val)
+{
+    rlog_t *log = vm->rlog;
+    revent_t *p = &log->pend;
+    uint64_t delta = vm->icount - (p->icount + p->reps * p->step);
+
+    if (log->held && p->kind == kind && p->val == val &&
+        (!p->reps || p->step == delta) && p->reps < UINT32_MAX)
+    {
+        p->step = delta;
+        p->reps++;
+        return;
+    }
+
+    rlog_write(log);
+    p->icount = vm->icount;
+    p->step = 0;
+    p->reps = 0;
+    p->val = val;
+    p->kind = kind;
+    log->held = 1;
+}
+
+/* The next event in the replayed log if it is a kind event at this
+ * instruction, which is then taken */
+static revent_t *replay_next(VM *vm, int kind)
+{
+    rlog_t *log = vm->rlog;
+    revent_t *e = &log->ev[log->pos];
+
+    if (log->pos == log->n || e->kind != kind ||
+        e->icount + log->rep * e->step != vm->icount)
+        return NULL;
+    if (log->rep++ == e->reps)
+    {
+        log->pos++;
+        log->rep = 0;
+    }
+    return e;
+}
+
+/* Take the read of loc from the log, setting the device registers as the
+ * live read did */
+static uint16_t replay_read(VM *vm, uint16_t loc)
+{
+    int kind = loc == KBSR ? RL_KBSR : loc == KBDR ? RL_KBDR : RL_TMR;
+    revent_t *e = replay_next(vm, kind);
+
+    if (!e)
+    {
+        diverged(vm);
+        return MEM(vm, loc);
+    }
+
+    switch (kind)
+    {
+    case RL_KBSR:
+        *vm->kbsr = e->val;
+        break;
+    case RL_KBDR:
+        *vm->kbdr = e->val;
+        *vm->kbsr |= 0x8000;
+        break;
+    case RL_TMR:
+        *vm->tmr = e->val & 0x7fff;
+        break;
+    }
+    return e->val;
+}
+
+/* Deliver the interrupt the log has at this instruction, if any */
+static void replay_irq(VM *vm)
+{
+    revent_t *e = replay_next(vm, RL_IRQ);
+
+    if (!e)
+        return;
+    if (!except(vm, e->val, e->val == TMR_VECT ? TMR_PL : KBD_PL))
+        diverged(vm);
+    else if (e->val == TMR_VECT)
+        *vm->tmr &= 0x7fff;
+}
+
+/* Deliver a pending timer or keyboard interrupt. Only called at the end of
+ * basic blocks, and the host is polled at most every POLL_INTERVAL
+ * instructions, so straight-line code pays nothing. */
+static void interrupt(VM *vm)
+{
+    int pl;
+
+    if (vm->icount < vm->poll_at)
+        return;
+    vm->poll_at = vm->icount + POLL_INTERVAL;
+
+    pl = (vm->reg[PSR] & PSR_PL) >> 8;
+    if (!vm->rlog || !vm->rlog->replay)
+        timer_check(vm);
+
+    /* IPIs come from the machine itself and are never logged */
+    if ((*vm->ipir & IPIR_IE) && __atomic_load_n(&vm->ipi, __ATOMIC_ACQUIRE) &&
+        pl < IPI_PL)
+    {
+        if (except(vm, IPI_VECT, IPI_PL))
+            __atomic_store_n(&vm->ipi, 0, __ATOMIC_RELAXED);
+    }
+    else if (vm->rlog && vm->rlog->replay)
+        replay_irq(vm);
+    else if ((*vm->tmr & TMR_IE) && (*vm->tmr & 0x8000) && pl < TMR_PL)
+    {
+        if (except(vm, TMR_VECT, TMR_PL))
+        {
+            *vm->tmr &= 0x7fff;
+            if (vm->rlog)
+                rlog_put(vm, RL_IRQ, TMR_VECT);
+        }
+    }
+    else if ((*vm->kbsr & KBSR_IE) && pl < KBD_PL && kbd_avail(vm))
+    {
+        if (except(vm, KBD_VECT, KBD_PL) && vm->rlog)
+            rlog_put(vm, RL_IRQ, KBD_VECT);
+    }
+}
+
+/* Note which devices may interrupt and poll them at the next block end */
+static void ien_update(VM *vm)
+{
+    vm->ien = (*vm->kbsr & KBSR_IE) | (*vm->tmr & TMR_IE) |
+              (*vm->ipir & IPIR_IE);
+    vm->poll_at = vm->icount;
+}
+
+/* Registers whose value comes from outside the machine */
+static uint16_t dev_input(VM *vm, uint16_t loc)
+{
+    uint16_t val;
+
+    switch (loc)
+    {
+    case KBSR:
+        if (!kbd_ready(vm))
+        {
+            idle(vm);
+            if (!kbd_ready(vm))
+                return *vm->kbsr &= 0x7fff;
+        }
+        return *vm->kbsr |= 0x8000;
+    case TMR:
+        timer_check(vm);
+        if (!(*vm->tmr & 0x8000))
+        {
+            idle(vm);
+            timer_check(vm);
+        }
+        /* Reading acknowledges an expiry */
+        val = *vm->tmr;
+        *vm->tmr &= 0x7fff;
+        return val;
+    default:
+        *vm->kbsr &= 0x7fff;
+        *vm->kbdr = kbd_getc(vm);
+        *vm->kbsr |= 0x8000;
+        return *vm->kbdr;
+    }
+}
+
+/* Registers in the device page */
+static uint16_t dev_read(VM *vm, uint16_t loc)
+{
+    uint16_t val;
+
+    switch (loc)
+    {
+    case KBSR:
+    case KBDR:
+    case TMR:
+        if (!vm->rlog)
+            return dev_input(vm, loc);
+        if (vm->rlog->replay)
+            return replay_read(vm, loc);
+        val = dev_input(vm, loc);
+        rlog_put(vm, loc == KBSR ? RL_KBSR : loc == KBDR ? RL_KBDR : RL_TMR,
+                 val);
+        return val;
+    case PSRR:
+        return psr_read(vm);
+    case HARTID:
+        return vm->hartid;
+    case NHARTS:
+        return vm->nharts;
+    case IPIR:
+        /* Reading acknowledges the interrupt */
+        return (*vm->ipir & IPIR_IE) |
+               (__atomic_exchange_n(&vm->ipi, 0, __ATOMIC_ACQ_REL) ? 0x8000
+                                                                    : 0);
+    }
+    if (loc >= PMC && loc < PMC + 2 * NPMC && !((loc - PMC) & 0x1))
+    {
+        val = vm->pmc[(loc - PMC) >> 1] >> 16;
+        MEM(vm, loc + 1) = vm->pmc[(loc - PMC) >> 1];
+        return val;
+    }
+    return MEM(vm, loc);
+}
+
+static void dev_write(VM *vm, uint16_t loc, uint16_t val)
+{
+    switch (loc)
+    {
+    case KBSR:
+        /* Only the interrupt enable bit is writable */
+        *vm->kbsr = (*vm->kbsr & ~KBSR_IE) | (val & KBSR_IE);
+        ien_update(vm);
+        return;
+    case TMR:
+        *vm->tmr = (*vm->tmr & ~TMR_IE) | (val & TMR_IE);
+        ien_update(vm);
+        return;
+    case IPIR:
+        *vm->ipir = val & IPIR_IE;
+        ien_update(vm);
+        return;
+    case IPIS:
+        if (val == vm->hartid)
+            __atomic_store_n(&vm->ipi, 1, __ATOMIC_RELEASE);
+        else if (val < vm->nharts)
+            __atomic_store_n(&vm->harts[val].ipi, 1, __ATOMIC_RELEASE);
+        return;
+    case AMOX:
+        MEM(vm, loc) = mem_swap(vm, MEM(vm, AMOA), val);
+        return;
+    case HARTID:
+    case NHARTS:
+        return;
+    case TMI:
+        *vm->tmi = val;
+        vm->tmr_next = clock_ms(vm) + val;
+        return;
+    case DDR:
+        *vm->dsr &= 0x7fff;
+        ddr_putc(vm, val);
+        *vm->dsr |= 0x8000;
+        break;
+    case PSRR:
+        psr_write(vm, val);
+        return;
+    case PMCR:
+        if (val & PMCR_RESET)
+            memset(vm->pmc, 0, sizeof(vm->pmc));
+        vm->pmon = !!(val & PMCR_RUN);
+        MEM(vm, loc) = val & PMCR_RUN;
+        return;
+    }
+    /* The counters are read-only */
+    if (loc >= PMC && loc < PMC + 2 * NPMC)
+        return;
+    MEM(vm, loc) = val;
+}
+
+/* Count the instruction about to run */
+static void pmc_count(VM *vm, uint16_t instr)
+{
+    vm->pmc[PMC_INSTR]++;
+
+    switch (instr >> 12)
+    {
+    case LD:
+    case LDR:
+        vm->pmc[PMC_LOAD]++;
+        break;
+    case LDI:
+        vm->pmc[PMC_LOAD] += 2;
+        break;
+    case ST:
+    case STR:
+        vm->pmc[PMC_STORE]++;
+        break;
+    case STI:
+        vm->pmc[PMC_LOAD]++;
+        vm->pmc[PMC_STORE]++;
+        break;
+    case BR:
+        vm->pmc[PMC_BRANCH]++;
+        if (CC_NZP(vm->cc) & (instr >> 9) & 0x7)
+            vm->pmc[PMC_TAKEN]++;
+        break;
+    }
+}
+
+/* Exchange val with the word at loc in one step no other hart can split,
+ * and return the old word */
+static uint16_t mem_swap(VM *vm, uint16_t loc, uint16_t val)
+{
+    uint8_t flags = vm->pflags[loc >> 8];
+    uint16_t old;
+
+    if (flags & PF_DEV)
+    {
+        old = mem_read(vm, loc);
+        mem_write(vm, loc, val);
+        return old;
+    }
+    if (flags & PF_WATCH)
+        watch_check(vm, loc);
+    if ((flags & PF_CODE) &&
+        ((vm->bcache->cmap[loc >> 3] >> (loc & 0x7)) & 0x1))
+        bcache_flush(vm);
+    return __atomic_exchange_n(&page_own(vm, loc >> 8)[loc & 0xff], val,
+                               __ATOMIC_SEQ_CST);
+}
+
+/* Stop after the current instruction if loc is watched */
+static void watch_check(VM *vm, uint16_t loc)
+{
+    if ((vm->wmap[loc >> 3] >> (loc & 0x7)) & 0x1)
+    {
+        vm->stop = VM_WATCH;
+        vm->stop_at = vm->icount;
+        vm->watch_addr = loc;
+    }
+}
+
+/* Pages with flags set take the slow path through the helpers below */
+static uint16_t flagged_read(VM *vm, uint16_t loc)
+{
+    uint8_t flags = vm->pflags[loc >> 8];
+
+    if (flags & PF_WATCH)
+        watch_check(vm, loc);
+    if (flags & PF_DEV)
+        return dev_read(vm, loc);
+    return MEM(vm, loc);
+}
+
+static void flagged_write(VM *vm, uint16_t loc, uint16_t val)
+{
+    uint8_t flags = vm->pflags[loc >> 8];
+
+    if (flags & PF_WATCH)
+        watch_check(vm, loc);
+    if ((flags & PF_CODE) &&
+        ((vm->bcache->cmap[loc >> 3] >> (loc & 0x7)) & 0x1))
+        bcache_flush(vm);
+    if (flags & PF_DEV)
+        dev_write(vm, loc, val);
+    else
+        page_own(vm, loc >> 8)[loc & 0xff] = val;
+}
+
+/* Give page p a private copy before it is written */
+static uint16_t *page_own(VM *vm, int p)
+{
+    uint16_t *copy;
+
+    if (!(vm->pflags[p] & PF_COW))
+        return vm->page[p];
+
+    copy = malloc(PAGE_WORDS * sizeof(uint16_t));
+    if (!copy)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(copy, vm->page[p], PAGE_WORDS * sizeof(uint16_t));
+    vm->page[p] = copy;
+    vm->pown[p] = 1;
+    vm->pflags[p] &= ~PF_COW;
+    return copy;
+}
+
+/* Copy n words to addr as a loader would, bypassing the devices */
+void mem_load(VM *vm, uint16_t addr, const uint16_t *src, size_t n)
+{
+    size_t a;
+
+    for (a = addr; a < addr + n && a < 0x10000; a++)
+        page_own(vm, a >> 8)[a & 0xff] = src[a - addr];
+    bcache_flush(vm);
+}
+
+/* Pages this machine has allocated for itself */
+size_t mem_pages(VM *vm)
+{
+    size_t n = 0;
+    int i;
+
+    for (i = 0; i < NPAGES; i++)
+        n += vm->pown[i];
+    return n;
+}
+
+uint16_t mem_read(VM *vm, uint16_t loc)
+{
+    /* Reading decoded code is harmless */
+    if (vm->pflags[loc >> 8] & (PF_DEV | PF_WATCH))
+        return flagged_read(vm, loc);
+    return MEM(vm, loc);
+}
+
+void mem_write(VM *vm, uint16_t loc, uint16_t val)
+{
+    if (vm->pflags[loc >> 8])
+        flagged_write(vm, loc, val);
+    else
+        MEM(vm, loc) = val;
+}
+
+static int brk_find(VM *vm, uint16_t addr)
+{
+    int i;
+    for (i = 0; i < vm->nbreak; i++)
+        if (vm->brk_addr[i] == addr)
+            return i;
+    return -1;
+}
+
+/* Plant a breakpoint by swapping the instruction at addr for BRK_INSTR, so
+ * execution runs at full speed until it is reached. */
+int brk_set(VM *vm, uint16_t addr)
+{
+    if (brk_find(vm, addr) != -1)
+        return 0;
+    if (vm->nbreak == MAXBREAK)
+        return -1;
+    vm->brk_addr[vm->nbreak] = addr;
+    vm->brk_orig[vm->nbreak++] = MEM(vm, addr);
+    page_own(vm, addr >> 8)[addr & 0xff] = BRK_INSTR;
+    bcache_flush(vm);
+    return 0;
+}
+
+int brk_clear(VM *vm, uint16_t addr)
+{
+    int i = brk_find(vm, addr);
+
+    if (i == -1)
+        return -1;
+    /* A word the guest has stored over since is its own */
+    if (MEM(vm, addr) == BRK_INSTR)
+        page_own(vm, addr >> 8)[addr & 0xff] = vm->brk_orig[i];
+    vm->brk_addr[i] = vm->brk_addr[--vm->nbreak];
+    vm->brk_orig[i] = vm->brk_orig[vm->nbreak];
+    bcache_flush(vm);
+    return 0;
+}
+
+/* Memory as the program sees it, with breakpoints hidden */
+uint16_t peek(VM *vm, uint16_t addr)
+{
+    int i = brk_find(vm, addr);
+    return i == -1 ? MEM(vm, addr) : vm->brk_orig[i];
+}
+
+/* Execute one instruction, stepping over a breakpoint at PC */
+int step(VM *vm)
+{
+    int i = brk_find(vm, vm->reg[PC]), status;
+    uint16_t addr = vm->reg[PC];
+
+    /* Breakpoints are planted in private pages, so these writes cannot
+     * fault in a copy */
+    if (i != -1)
+        MEM(vm, addr) = vm->brk_orig[i];
+    status = run(vm, 1);
+    if (i != -1 && MEM(vm, addr) == vm->brk_orig[i])
+        MEM(vm, addr) = BRK_INSTR;
+    return status;
+}
+
+/* Watchpoints flag the whole page so unwatched pages keep the fast path */
+int watch_set(VM *vm, uint16_t addr)
+{
+    if (!vm->wmap)
+    {
+        vm->wmap = calloc(0x10000 / 8, 1);
+        if (!vm->wmap)
+            return -1;
+    }
+    vm->wmap[addr >> 3] |= 1 << (addr & 0x7);
+    vm->pflags[addr >> 8] |= PF_WATCH;
+    return 0;
+}
+
+int watch_clear(VM *vm, uint16_t addr)
+{
+    int i, page = addr >> 8;
+
+    if (!vm->wmap || !((vm->wmap[addr >> 3] >> (addr & 0x7)) & 0x1))
+        return -1;
+    vm->wmap[addr >> 3] &= ~(1 << (addr & 0x7));
+
+    /* Drop the page flag once its last watch is gone */
+    for (i = page << 5; i < (page + 1) << 5; i++)
+        if (vm->wmap[i])
+            return 0;
+    vm->pflags[page] &= ~PF_WATCH;
+    return 0;
+}
+
+uint16_t read_obj(VM *vm, const char *path)
+{
+    uint16_t start;
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "unable to open img\n");
+        exit(1);
+    }
+    start = read_obj_file(vm, fp);
+
+    fclose(fp);
+
+    return start;
+}
+
+/* Whether w cannot be an instruction: its opcode is reserved, or bits
+ * that must be clear or set are not */
+static int obj_odd(uint16_t w)
+{
+    switch (w >> 12)
+    {
+    case ADD:
+    case AND:
+        return !(w & 0x20) && (w & 0x18);
+    case JSR:
+        return !(w & 0x800) && (w & 0x63f);
+    case RTI:
+        return w != 0x8000;
+    case NOT:
+        return (w & 0x3f) != 0x3f;
+    case JMP:
+        return (w & 0xe3f) != 0;
+    case RES:
+        return 1;
+    case TRAP:
+        return (w & 0xf00) != 0;
+    }
+    return 0;
+}
+
+/* Whether an object's first word, read in the order given, makes an
+ * origin its image fits behind, and one on a page boundary; and how much
+ * its first page reads like a program. Small numbers and characters count
+ * for it, and words that cannot be instructions twice against. */
+static void obj_score(const uint8_t *data, size_t len, int order, int *fits,
+                      int *aligned, int *like)
+{
+    size_t i, n = len / 2 - 1;
+    uint16_t w;
+
+    w = order == OBJ_BIG ? data[0] << 8 | data[1] : data[1] << 8 | data[0];
+    *fits = w + n <= 0x10000;
+    *aligned = !(w & 0xff);
+    *like = 0;
+    for (i = 1; i <= n && i <= PAGE_WORDS; i++)
+    {
+        w = order == OBJ_BIG ? data[2 * i] << 8 | data[2 * i + 1]
+                             : data[2 * i + 1] << 8 | data[2 * i];
+        *like += (w && w < 0x100) - 2 * obj_odd(w);
+    }
+}
+
+/* Guess which byte order an object file is in. Nothing in the file says,
+ * so the order that reads more like a program wins; a tie goes to
+ * little-endian, as this toolchain has always written. */
+int obj_guess(const uint8_t *data, size_t len)
+{
+    int lfits, laligned, llike, bfits, baligned, blike;
+
+    if (len < 2)
+        return OBJ_LITTLE;
+    obj_score(data, len, OBJ_LITTLE, &lfits, &laligned, &llike);
+    obj_score(data, len, OBJ_BIG, &bfits, &baligned, &blike);
+
+    if (lfits != bfits)
+        return bfits ? OBJ_BIG : OBJ_LITTLE;
+    if (laligned != baligned)
+        return baligned ? OBJ_BIG : OBJ_LITTLE;
+    return blike > llike ? OBJ_BIG : OBJ_LITTLE;
+}
+
+/* The words of an object file, in this machine's byte order. An odd last
+ * byte is dropped. */
+uint16_t *obj_words(const uint8_t *data, size_t len)
+{
+    uint16_t *w = malloc(len ? len : 1);
+    int order = obj_order ? obj_order : obj_guess(data, len);
+
+    if (!w)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(w, data, len & ~(size_t)1);
+    if (order != host_order())
+        swap16(w, len / 2);
+    return w;
+}
+
+uint16_t read_obj_file(VM *vm, FILE *file)
+{
+    uint8_t *data;
+    uint16_t *w, origin = 0;
+    size_t len;
+
+    /* Nothing past the end of memory is loaded, so no more is read */
+    data = malloc(2 * 0x10001);
+    if (!data)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    len = fread(data, 1, 2 * 0x10001, file);
+    w = obj_words(data, len);
+    free(data);
+
+    /* First word of file should be origin */
+    if (len >= 2)
+    {
+        origin = w[0];
+        mem_load(vm, origin, w + 1, len / 2 - 1);
+    }
+    free(w);
+
+    return origin;
+}
+
+/* Load an image held in memory; the origin, or -1 if it is malformed */
+int obj_load(VM *vm, const uint8_t *data, size_t len)
+{
+    uint16_t *w;
+    int origin;
+
+    if (len < 2 || len % 2)
+        return -1;
+    w = obj_words(data, len);
+    origin = w[0];
+    len = len / 2 - 1;
+    if (origin + len > DEVPAGE)
+    {
+        free(w);
+        return -1;
+    }
+
+    mem_load(vm, origin, w + 1, len);
+    free(w);
+
+    return origin;
+}
+
+/* Merge the coverage saved in path into c. Returns -1 if there is none. */
+int cov_load(cov_t *c, const char *path)
+{
+    cov_t *in = malloc(sizeof(*in));
+    char magic[4];
+    FILE *fp = fopen(path, "rb");
+    int ok;
+
+    if (!fp || !in)
+    {
+        if (fp)
+            fclose(fp);
+        free(in);
+        return -1;
+    }
+    ok = fread(magic, sizeof(magic), 1, fp) == 1 &&
+         memcmp(magic, COV_MAGIC, sizeof(magic)) == 0 &&
+         fread(in, sizeof(*in), 1, fp) == 1;
+    fclose(fp);
+
+    if (ok)
+        cov_merge(c, in);
+    free(in);
+    return ok ? 0 : -1;
+}
+
+int cov_save(const cov_t *c, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    int ok;
+
+    if (!fp)
+        return -1;
+    ok = fwrite(COV_MAGIC, 4, 1, fp) == 1 && fwrite(c, sizeof(*c), 1, fp) == 1;
+    return fclose(fp) == 0 && ok ? 0 : -1;
+}
+
+void cov_merge(cov_t *dst, const cov_t *src)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(dst->addr); i++)
+    {
+        dst->addr[i] |= src->addr[i];
+        dst->edge[i] |= src->edge[i];
+    }
+}
+
+/* Record the machine's input to path as it runs */
+int rlog_record(VM *vm, rlog_t *log, const char *path)
+{
+    memset(log, 0, sizeof(*log));
+    log->fp = fopen(path, "wb");
+    if (!log->fp)
+        return -1;
+    fwrite(RLOG_MAGIC, 4, 1, log->fp);
+    log->last = vm->icount;
+    vm->rlog = log;
+    return 0;
+}
+
+/* Feed the machine the input logged in path. The host's keyboard is cut
+ * off; the log is all the input there is. */
+int rlog_replay(VM *vm, rlog_t *log, const char *path)
+{
+    revent_t *ev, e;
+    uint64_t at = 0, delta, reps;
+    char magic[4];
+    int c, lo, hi;
+    size_t cap = 0;
+    FILE *fp = fopen(path, "rb");
+
+    memset(log, 0, sizeof(*log));
+    log->replay = 1;
+    if (!fp)
+        return -1;
+    if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+        memcmp(magic, RLOG_MAGIC, sizeof(magic)) != 0)
+        goto bad;
+
+    while ((c = getc(fp)) != EOF)
+    {
+        memset(&e, 0, sizeof(e));
+        e.kind = c & 0x7f;
+        if (e.kind > RL_IRQ || get_varint(fp, &delta) == -1)
+            goto bad;
+        lo = getc(fp);
+        hi = getc(fp);
+        if (hi == EOF)
+            goto bad;
+        e.val = lo | hi << 8;
+        e.icount = at + delta;
+        if ((c & 0x80) && (get_varint(fp, &reps) == -1 ||
+                           get_varint(fp, &e.step) == -1 || !reps ||
+                           reps > UINT32_MAX))
+            goto bad;
+        e.reps = c & 0x80 ? reps : 0;
+        at = e.icount + e.reps * e.step;
+
+        if (log->n == cap)
+        {
+            cap = cap ? 2 * cap : 1024;
+            ev = realloc(log->ev, cap * sizeof(*ev));
+            if (!ev)
+            {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            log->ev = ev;
+        }
+        log->ev[log->n++] = e;
+    }
+    fclose(fp);
+
+    vm->infd = -1;
+    vm->kbeof = 1;
+    vm->rlog = log;
+    return 0;
+
+bad:
+    fclose(fp);
+    free(log->ev);
+    log->ev = NULL;
+    log->n = 0;
+    return -1;
+}
+
+/* Finish with a log. Returns -1 if a recording could not be written. */
+int rlog_close(rlog_t *log)
+{
+    int ok = 1;
+
+    if (log->fp)
+    {
+        rlog_write(log);
+        ok = !ferror(log->fp) & (fclose(log->fp) == 0);
+    }
+    free(log->ev);
+    memset(log, 0, sizeof(*log));
+    return ok ? 0 : -1;
+}
+
+/* Everything a snapshot holds besides memory, which follows it as each
+ * page's number and contents */
+typedef struct snap_s
+{
+    char magic[4];
+    uint16_t reg[10];
+    uint16_t saved_ssp;
+    uint16_t saved_usp;
+    uint16_t idle_pc;
+    uint32_t cc;
+    int32_t ien;
+    int32_t pmon;
+    int32_t ipi;
+    uint32_t npages;
+    uint64_t icount;
+    uint64_t nout;
+    uint64_t poll_at;
+    uint64_t clock;
+    uint64_t vskew;
+    uint64_t tmr_next;
+    uint64_t idle_at;
+    uint64_t nidle;
+    uint64_t pmc[NPMC];
+    uint64_t rlpos; /* the next event of the input log */
+    uint32_t rlrep; /* and how many times it has already happened */
+} snap_t;
+
+/* Save the state of a single-hart machine that is not running. With a log
+ * attached the snapshot notes how far into it the machine is, so a replay
+ * can start from the snapshot instead of from boot. */
+int snap_save(VM *vm, const char *path)
+{
+    snap_t s;
+    uint8_t p8;
+    int p, ok;
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp)
+        return -1;
+
+    memset(&s, 0, sizeof(s));
+    memcpy(s.magic, SNAP_MAGIC, sizeof(s.magic));
+    memcpy(s.reg, vm->reg, sizeof(s.reg));
+    s.saved_ssp = vm->saved_ssp;
+    s.saved_usp = vm->saved_usp;
+    s.idle_pc = vm->idle_pc;
+    s.cc = vm->cc;
+    s.ien = vm->ien;
+    s.pmon = vm->pmon;
+    s.ipi = vm->ipi;
+    s.icount = vm->icount;
+    s.nout = vm->nout;
+    s.poll_at = vm->poll_at;
+    s.clock = clock_ms(vm);
+    s.vskew = vm->vskew;
+    s.tmr_next = vm->tmr_next;
+    s.idle_at = vm->idle_at;
+    s.nidle = vm->nidle;
+    memcpy(s.pmc, vm->pmc, sizeof(s.pmc));
+    if (vm->rlog && vm->rlog->replay)
+    {
+        s.rlpos = vm->rlog->pos;
+        s.rlrep = vm->rlog->rep;
+    }
+    else if (vm->rlog)
+    {
+        s.rlpos = vm->rlog->n;
+        s.rlrep = vm->rlog->held ? vm->rlog->pend.reps + 1 : 0;
+    }
+    for (p = 0; p < NPAGES; p++)
+        s.npages += vm->page[p] != zero_page;
+
+    ok = fwrite(&s, sizeof(s), 1, fp) == 1;
+    for (p = 0; p < NPAGES && ok; p++)
+    {
+        if (vm->page[p] == zero_page)
+            continue;
+        p8 = p;
+        ok = fwrite(&p8, 1, 1, fp) == 1 &&
+             fwrite(vm->page[p], sizeof(uint16_t), PAGE_WORDS, fp) ==
+                 PAGE_WORDS;
+    }
+    return fclose(fp) == 0 && ok ? 0 : -1;
+}
+
+/* Put a booted machine in the state saved in path. Pages the snapshot
+ * does not have are zero. A log being replayed skips to where the snapshot
+ * was taken. */
+int snap_load(VM *vm, const char *path)
+{
+    snap_t s;
+    rlog_t *log = vm->rlog && vm->rlog->replay ? vm->rlog : NULL;
+    uint8_t p8;
+    uint32_t i;
+    int p, ok;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+        return -1;
+    ok = fread(&s, sizeof(s), 1, fp) == 1 &&
+         memcmp(s.magic, SNAP_MAGIC, sizeof(s.magic)) == 0;
+
+    /* The log must reach as far as the snapshot */
+    if (ok && log)
+    {
+        if (s.rlpos < log->n && s.rlrep == log->ev[s.rlpos].reps + 1)
+        {
+            s.rlpos++;
+            s.rlrep = 0;
+        }
+        ok = s.rlpos < log->n ? s.rlrep <= log->ev[s.rlpos].reps
+                              : s.rlpos == log->n && !s.rlrep;
+    }
+    if (!ok)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    for (p = 0; p < NPAGES; p++)
+    {
+        if (vm->pflags[p] & PF_DEV)
+            continue;
+        if (vm->pown[p])
+            free(vm->page[p]);
+        vm->page[p] = zero_page;
+        vm->pown[p] = 0;
+        vm->pflags[p] = (vm->pflags[p] & PF_WATCH) | PF_COW;
+    }
+    for (i = 0; i < s.npages && ok; i++)
+        ok = fread(&p8, 1, 1, fp) == 1 &&
+             fread(page_own(vm, p8), sizeof(uint16_t), PAGE_WORDS, fp) ==
+                 PAGE_WORDS;
+    fclose(fp);
+    bcache_flush(vm);
+    if (!ok)
+        return -1;
+
+    memcpy(vm->reg, s.reg, sizeof(vm->reg));
+    vm->saved_ssp = s.saved_ssp;
+    vm->saved_usp = s.saved_usp;
+    vm->idle_pc = s.idle_pc;
+    vm->cc = s.cc;
+    vm->ien = s.ien;
+    vm->pmon = s.pmon;
+    vm->ipi = s.ipi;
+    vm->icount = s.icount;
+    vm->nout = s.nout;
+    vm->poll_at = s.poll_at;
+    vm->epoch = host_ms() - s.clock;
+    vm->vskew = s.vskew;
+    vm->tmr_next = s.tmr_next;
+    vm->idle_at = s.idle_at;
+    vm->nidle = s.nidle;
+    memcpy(vm->pmc, s.pmc, sizeof(vm->pmc));
+    if (log)
+    {
+        log->pos = s.rlpos;
+        log->rep = s.rlrep;
+    }
+    else if (vm->rlog)
+        vm->rlog->last = vm->icount;
+    return 0;
+}
+
+/* Load a program once so that many machines can map it */
+image_t *image_load(const char *path)
+{
+    image_t *img = calloc(1, sizeof(*img));
+    VM *vm = malloc(sizeof(*vm));
+    int i;
+
+    if (!img || !vm)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    /* Keep the pages a scratch machine allocated while loading */
+    boot(vm);
+    img->origin = read_obj(vm, path);
+    for (i = 0; i < NPAGES; i++)
+    {
+        if (vm->pown[i] && !(vm->pflags[i] & PF_DEV))
+        {
+            img->page[i] = vm->page[i];
+            vm->pown[i] = 0;
+        }
+    }
+    poweroff(vm);
+    free(vm);
+
+    return img;
+}
+
+/* Map img copy-on-write into a booted machine and return its origin. The
+ * image must outlive the machine. */
+uint16_t image_map(VM *vm, const image_t *img)
+{
+    int i;
+
+    for (i = 0; i < NPAGES; i++)
+    {
+        if (!img->page[i] || (vm->pflags[i] & PF_DEV))
+            continue;
+        if (vm->pown[i])
+            free(vm->page[i]);
+        vm->page[i] = img->page[i];
+        vm->pown[i] = 0;
+        vm->pflags[i] |= PF_COW;
+    }
+    bcache_flush(vm);
+
+    return img->origin;
+}
+
+void image_free(image_t *img)
+{
+    int i;
+
+    for (i = 0; i < NPAGES; i++)
+        free(img->page[i]);
+    free(img);
+}
+
+void buf_put(buf_t *b, uint8_t c)
+{
+    if (b->len == b->cap)
+    {
+        b->cap = b->cap ? b->cap * 2 : 4096;
+        b->data = realloc(b->data, b->cap);
+        if (!b->data)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    b->data[b->len++] = c;
+}
+
+uint16_t sext(uint16_t x, uint16_t nbits)
+{
+    if ((x >> (nbits - 1)) & 1)
+        x |= (0xffff << nbits);
+    return x;
+}
+
+/* The PSR with its condition codes brought up to date */
+uint16_t psr_read(VM *vm)
+{
+    return (vm->reg[PSR] & ~0x7) | CC_NZP(vm->cc);
+}
+
+void psr_write(VM *vm, uint16_t psr)
+{
+    vm->reg[PSR] = psr;
+    vm->cc = CC_RAW | (psr & 0x7);
+}
+
+void setcc(VM *vm, uint16_t r)
+{
+    vm->cc = vm->reg[r];
 }
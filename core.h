@@ -0,0 +1,375 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "swap.h"
+#include "trace.h"
+
+/* Breakpoints replace an instruction with this reserved encoding */
+#define MAXBREAK 64
+#define BRK_INSTR 0xd0db
+
+/* Guest memory is 256 pages of 256 words */
+#define PAGE_WORDS 256
+#define NPAGES 256
+
+/* Page flags */
+#define PF_DEV 0x1
+#define PF_WATCH 0x2
+#define PF_CODE 0x4 /* holds instructions decoded by the fused engine */
+#define PF_COW 0x8  /* shared; the first write takes a private copy */
+
+/* Execution engines */
+enum
+{
+    ENG_INTERP = 0,
+    ENG_FUSED,
+    ENG_LOCKSTEP, /* batches only; a lone machine interprets */
+};
+
+/* Superinstructions the fused engine dispatches as one handler */
+enum
+{
+    F_ADDI_BR = 0, /* ADD Rd, Rs, #imm; BR */
+    F_LDR_ADD,     /* LDR; ADD */
+    F_CLR_ADDI,    /* AND Rd, Rs, #0; ADD Rd, Rd, #imm */
+    F_LDI_BR,      /* LDI; BR, the device poll loop */
+    F_LDR_STR,     /* LDR; STR, a word copy */
+    NFUSE,
+};
+
+extern const char *fuse_name[NFUSE];
+
+/* Byte order the loader takes object files to be in; OBJ_AUTO guesses */
+extern int obj_order;
+
+/* Guest performance counters */
+enum
+{
+    PMC_INSTR = 0,
+    PMC_LOAD,
+    PMC_STORE,
+    PMC_BRANCH, /* BR instructions */
+    PMC_TAKEN,  /* BR instructions that branched */
+    NPMC,
+};
+
+/* Byte buffer for headless I/O. Buffers with cap 0 are not owned. */
+typedef struct buf_s
+{
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    size_t pos;
+} buf_t;
+
+struct bcache_s;
+
+/* Code coverage: a bit for each address executed, and one for each control
+ * transfer by BR, JMP or JSR, hashed from its source and destination */
+typedef struct cov_s
+{
+    uint8_t addr[0x10000 / 8];
+    uint8_t edge[0x10000 / 8];
+} cov_t;
+
+#define COV_EDGE(from, to) ((uint16_t)((from)*40503u ^ (to)))
+#define COV_SET(map, i) ((map)[(uint16_t)(i) >> 3] |= 1 << ((i)&0x7))
+#define COV_GET(map, i) (((map)[(uint16_t)(i) >> 3] >> ((i)&0x7)) & 0x1)
+
+#define COV_MAGIC "LC3V"
+
+/* Input log: every read of the keyboard and timer registers and every
+ * interrupt they raised, with the icount it happened at. A machine
+ * replaying a log takes these from it and never touches the host's input
+ * or clock. */
+enum
+{
+    RL_KBSR = 0,
+    RL_KBDR,
+    RL_TMR,
+    RL_IRQ, /* val is the vector delivered */
+};
+
+typedef struct revent_s
+{
+    uint64_t icount; /* of the first occurrence */
+    uint64_t step;   /* instructions between repeats */
+    uint32_t reps;   /* further occurrences, as in a poll loop */
+    uint16_t val;
+    uint8_t kind;
+} revent_t;
+
+typedef struct rlog_s
+{
+    int replay;
+
+    /* Recording: the file, the last event, held back while it repeats, and
+     * the icount the last one written last happened at */
+    FILE *fp;
+    revent_t pend;
+    int held;
+    uint64_t last;
+
+    /* Replaying: the whole log, the next event and how many times it has
+     * already happened */
+    revent_t *ev;
+    size_t pos;
+    uint32_t rep;
+
+    size_t n; /* events in the log, or written so far */
+} rlog_t;
+
+#define RLOG_MAGIC "LC3R"
+#define SNAP_MAGIC "LC3S"
+
+/* A loaded program whose pages can be mapped into many machines */
+typedef struct image_s
+{
+    uint16_t origin;
+    uint16_t *page[NPAGES]; /* NULL where the image has nothing */
+} image_t;
+
+typedef struct VM
+{
+    /* Page table. Pages start out mapped copy-on-write to the boot ROM or
+     * a shared zero page; pown marks the ones this machine allocated. */
+    uint16_t *page[NPAGES];
+    uint8_t pown[NPAGES];
+
+    uint16_t reg[10];
+
+    /* Condition codes, kept as the last value written to a register; the
+     * NZP bits of reg[PSR] are stale */
+    uint32_t cc;
+
+    uint16_t *kbsr;
+    uint16_t *kbdr;
+    uint16_t *dsr;
+    uint16_t *ddr;
+    uint16_t *tmr;
+    uint16_t *tmi;
+    uint16_t *ipir;
+    uint16_t *mcr;
+
+    /* Stack pointer of the mode not currently running */
+    uint16_t saved_ssp;
+    uint16_t saved_usp;
+
+    /* Earliest icount at which to poll the host for interrupts, and
+     * whether any device has interrupts enabled */
+    uint64_t poll_at;
+    int ien;
+
+    /* Clock origin, virtual clock adjustment and next timer expiry, in ms */
+    uint64_t epoch;
+    uint64_t vskew;
+    uint64_t tmr_next;
+
+    /* Poll loop detection: PC and icount of the last status register miss,
+     * and the number of times the host was parked */
+    uint16_t idle_pc;
+    uint64_t idle_at;
+    uint64_t nidle;
+
+    /* Host descriptor and stream behind the keyboard and display */
+    int infd;
+    int kbeof;
+    FILE *out;
+
+    /* The keyboard reads from inbuf, which is refilled from infd unless we
+     * are headless. In headless mode the display appends to outbuf instead
+     * of writing to out. */
+    int headless;
+    buf_t inbuf;
+    buf_t outbuf;
+
+    /* When grading, each byte written to the display is checked against
+     * want, and want.pos counts the bytes that matched */
+    int grading;
+    buf_t want;
+
+    /* Retired instructions and bytes written to the display */
+    uint64_t icount;
+    uint64_t nout;
+
+    /* Guest performance counters, and whether they are running. Only the
+     * interpreter counts, so the other engines hand over to it while they
+     * run. */
+    int pmon;
+    uint64_t pmc[NPMC];
+
+    /* Harts of one machine share its memory. Each knows its number and
+     * its siblings, and ipi is raised by any of them. */
+    int hartid;
+    int nharts;
+    struct VM *harts;
+    int ipi;
+
+    /* Execution trace ring, or NULL */
+    trace_t *trace;
+
+    /* Coverage bitmaps to set bits in, or NULL. Clones share them. */
+    cov_t *cov;
+
+    /* Input log being recorded or replayed, or NULL. Logged machines run on
+     * the interpreter so that interrupts land on the same instruction. */
+    rlog_t *rlog;
+
+    /* Per-page flags; pages with any flag set leave the fast memory path */
+    uint8_t pflags[NPAGES];
+
+    /* run() returns stop, or VM_BUDGET, once icount reaches stop_at */
+    uint64_t stop_at;
+    int stop;
+
+    /* Breakpoints and the instructions they replaced */
+    uint16_t brk_addr[MAXBREAK];
+    uint16_t brk_orig[MAXBREAK];
+    int nbreak;
+
+    /* Watched addresses, one bit each, and the last one to fire */
+    uint8_t *wmap;
+    uint16_t watch_addr;
+
+    /* Engine run() uses, the fused engine's decoded blocks and how often
+     * each superinstruction fired */
+    int engine;
+    struct bcache_s *bcache;
+    uint64_t nfused[NFUSE];
+
+} VM;
+
+/* Registers */
+enum
+{
+    R0 = 0,
+    R1,
+    R2,
+    R3,
+    R4,
+    R5,
+    R6,
+    R7,
+    PC,
+    PSR,
+};
+
+/* The word at addr, for reading. Writes go through mem_write(). */
+#define MEM(vm, addr) ((vm)->page[(uint16_t)(addr) >> 8][(addr)&0xff])
+
+/* Device registers */
+#define DEVPAGE 0xfe00
+#define KBSR 0xfe00
+#define KBDR 0xfe02
+#define DSR 0xfe04
+#define DDR 0xfe06
+#define TMR 0xfe08
+#define TMI 0xfe0a
+#define PMCR 0xfe10
+#define PMC 0xfe12
+#define HARTID 0xfe20
+#define NHARTS 0xfe22
+#define IPIR 0xfe24
+#define IPIS 0xfe26
+#define AMOA 0xfe28
+#define AMOX 0xfe2a
+#define PSRR 0xfffc
+#define MCR 0xfffe
+
+#define KBSR_IE 0x4000
+#define TMR_IE 0x4000
+
+/* PMCR starts and stops the counters; writing PMCR_RESET clears them.
+ * Counter i is the pair at PMC + 2i, high word first. Reading the high word
+ * latches the low word so the pair reads consistently. */
+#define PMCR_RUN 0x8000
+#define PMCR_RESET 0x0001
+
+/* IPIR[15] is set when another hart writes our number to IPIS. Writing a
+ * value to AMOX swaps it with the word at AMOA atomically; reading AMOX
+ * gives the word the last swap replaced. */
+#define IPIR_IE 0x4000
+
+/* Processor status: user mode, priority level, condition codes */
+#define PSR_USER 0x8000
+#define PSR_PL 0x0700
+
+/* NZP from vm->cc. After the PSR itself is written, cc holds its NZP bits
+ * verbatim, marked with CC_RAW. */
+#define CC_RAW 0x10000
+#define CC_NZP(cc)                                                             \
+    ((cc) & CC_RAW ? (cc) & 0x7 : (cc) >> 15 ? 0x4 : (cc) ? 0x1 : 0x2)
+
+/* Interrupt vector table; exceptions are vectors 0x00-0x7f and
+ * interrupts 0x80-0xff */
+#define IVT 0x0100
+#define PRIV_VECT 0x00
+#define ILL_VECT 0x01
+#define KBD_VECT 0x80
+#define KBD_PL 4
+#define TMR_VECT 0x81
+#define TMR_PL 5
+#define IPI_VECT 0x82
+#define IPI_PL 6
+
+/* Reasons for run() to return */
+enum
+{
+    VM_HALT = 0,
+    VM_BUDGET,
+    VM_ILLEGAL,
+    VM_PRIV,
+    VM_BREAK,
+    VM_WATCH,
+    VM_STOP,
+    VM_MISMATCH, /* output differs from or ran past what grade() expects */
+    VM_DIVERGED, /* the program no longer does what the replayed log says */
+};
+
+void boot(VM *vm);
+void vm_clone(VM *dst, const VM *src);
+void smp_boot(VM *harts, int n);
+void poweroff(VM *vm);
+void headless(VM *vm, const uint8_t *in, size_t len);
+void grade(VM *vm, const uint8_t *want, size_t len);
+int run(VM *vm, uint64_t budget);
+
+uint16_t mem_read(VM *vm, uint16_t loc);
+void mem_write(VM *vm, uint16_t loc, uint16_t val);
+
+int brk_set(VM *vm, uint16_t addr);
+int brk_clear(VM *vm, uint16_t addr);
+int watch_set(VM *vm, uint16_t addr);
+int watch_clear(VM *vm, uint16_t addr);
+uint16_t peek(VM *vm, uint16_t addr);
+uint16_t psr_read(VM *vm);
+void psr_write(VM *vm, uint16_t psr);
+int step(VM *vm);
+
+void mem_load(VM *vm, uint16_t addr, const uint16_t *src, size_t n);
+size_t mem_pages(VM *vm);
+
+uint16_t read_obj(VM *vm, const char *path);
+uint16_t read_obj_file(VM *vm, FILE *file);
+int obj_load(VM *vm, const uint8_t *data, size_t len);
+int obj_guess(const uint8_t *data, size_t len);
+uint16_t *obj_words(const uint8_t *data, size_t len);
+image_t *image_load(const char *path);
+uint16_t image_map(VM *vm, const image_t *img);
+void image_free(image_t *img);
+void buf_put(buf_t *b, uint8_t c);
+int cov_load(cov_t *c, const char *path);
+int cov_save(const cov_t *c, const char *path);
+void cov_merge(cov_t *dst, const cov_t *src);
+int rlog_record(VM *vm, rlog_t *log, const char *path);
+int rlog_replay(VM *vm, rlog_t *log, const char *path);
+int rlog_close(rlog_t *log);
+int snap_save(VM *vm, const char *path);
+int snap_load(VM *vm, const char *path);
+uint16_t sext(uint16_t x, uint16_t nbits);
+void setcc(VM *vm, uint16_t r);
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "panic.h"
+
+diag_t *diags;
+int ndiags;
+static int diagcap;
+
+/* Names of the files other than the one being assembled */
+static char **files;
+static int nfiles;
+
+/* Record an error and carry on. The same error reported twice at the same
+ * place is kept once. */
+void diag(pos_t at, const char *fmt, ...)
+{
+    diag_t *p;
+    va_list ap;
+    char msg[sizeof(p->msg)];
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    if (ndiags)
+    {
+        p = &diags[ndiags - 1];
+        if (p->at.file == at.file && p->at.line == at.line &&
+            p->at.col == at.col && strcmp(p->msg, msg) == 0)
+            return;
+    }
+
+    if (ndiags == diagcap)
+    {
+        p = realloc(diags, (diagcap ? 2 * diagcap : 16) * sizeof(*p));
+        if (!p)
+            panic("diag: out of memory");
+        diags = p;
+        diagcap = diagcap ? 2 * diagcap : 16;
+    }
+    diags[ndiags].at = at;
+    strcpy(diags[ndiags].msg, msg);
+    ndiags++;
+}
+
+/* Number another file that errors may be found in */
+int diag_file(const char *name)
+{
+    char **p = realloc(files, (nfiles + 1) * sizeof(*p));
+
+    if (!p)
+        panic("diag: out of memory");
+    files = p;
+    if (!(files[nfiles] = malloc(strlen(name) + 1)))
+        panic("diag: out of memory");
+    strcpy(files[nfiles], name);
+    return ++nfiles;
+}
+
+void diag_reset(void)
+{
+    while (nfiles)
+        free(files[--nfiles]);
+    ndiags = 0;
+}
+
+static int bypos(const void *a, const void *b)
+{
+    const diag_t *x = a, *y = b;
+
+    if (x->at.file != y->at.file)
+        return x->at.file - y->at.file;
+    if (x->at.line != y->at.line)
+        return x->at.line - y->at.line;
+    if (x->at.col != y->at.col)
+        return x->at.col - y->at.col;
+    return 0;
+}
+
+/* Write a JSON string */
+static void json_str(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%04x", *s);
+        else
+            putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/* Write the errors in source order, as "name:line:col: error: message"
+ * lines, or as one JSON object per line if machine is set. name is that of
+ * the file being assembled, and may be NULL. */
+void diag_report(FILE *fp, const char *name, int machine)
+{
+    const char *file;
+    int i;
+
+    qsort(diags, ndiags, sizeof(*diags), bypos);
+    for (i = 0; i < ndiags; i++)
+    {
+        file = diags[i].at.file ? files[diags[i].at.file - 1] : name;
+        if (!machine)
+        {
+            if (file)
+                fprintf(fp, "%s:", file);
+            fprintf(fp, "%d:%d: error: %s\n", diags[i].at.line,
+                    diags[i].at.col, diags[i].msg);
+            continue;
+        }
+
+        fprintf(fp, "{\"file\":");
+        if (file)
+            json_str(fp, file);
+        else
+            fprintf(fp, "null");
+        fprintf(fp, ",\"line\":%d,\"col\":%d,\"severity\":\"error\",",
+                diags[i].at.line, diags[i].at.col);
+        fprintf(fp, "\"message\":");
+        json_str(fp, diags[i].msg);
+        fprintf(fp, "}\n");
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stdio.h>
+
+/* A place in the source: a file as numbered by diag_file(), 0 being the
+ * one being assembled, and a 1-based line and column */
+typedef struct pos_s
+{
+    int file;
+    int line;
+    int col;
+} pos_t;
+
+/* An error found while assembling */
+typedef struct diag_s
+{
+    pos_t at;
+    char msg[128];
+} diag_t;
+
+/* Errors found since diag_reset(), in the order they were found */
+extern diag_t *diags;
+extern int ndiags;
+
+void diag(pos_t at, const char *fmt, ...);
+int diag_file(const char *name);
+void diag_reset(void);
+void diag_report(FILE *fp, const char *name, int machine);
+
+#endif
@@ -1,6 +1,7 @@
 #include <string.h>
 
-char *dirtable[] = {"ORIG", "FILL", "BLKW", "STRINGZ", "END"};
+char *dirtable[] = {"ORIG",  "FILL", "BLKW",    "STRINGZ", "END",
+                    "MACRO", "ENDM", "INCLUDE", "EQU"};
 
 int lookup_directive(char *lexeme)
 {
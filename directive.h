@@ -7,6 +7,13 @@
 #define STRINGZ 3
 #define END 4
 
+/* Handled before the parser sees them */
+#define MACRO 5
+#define ENDM 6
+#define INCLUDE 7
+
+#define EQU 8
+
 extern char *dirtable[];
 
 int lookup_directive(char *lexeme);
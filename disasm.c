@@ -0,0 +1,121 @@
+#include <stdio.h>
+
+#include "disasm.h"
+#include "op.h"
+
+static int sext(int x, int nbits)
+{
+    if ((x >> (nbits - 1)) & 1)
+        x -= 1 << nbits;
+    return x;
+}
+
+static const char *trapname(int vect)
+{
+    switch (vect)
+    {
+    case GETC:
+        return "GETC";
+    case OUT:
+        return "OUT";
+    case PUTS:
+        return "PUTS";
+    case IN:
+        return "IN";
+    case PUTSP:
+        return "PUTSP";
+    case HALT:
+        return "HALT";
+    }
+    return NULL;
+}
+
+/* Render instr, fetched from pc, in assembler syntax. PC-relative operands
+ * are shown as absolute addresses. */
+void disasm(char *buf, size_t size, uint16_t pc, uint16_t instr)
+{
+    int dr = (instr >> 9) & 0x7, sr1 = (instr >> 6) & 0x7;
+    uint16_t next = pc + 1;
+    const char *name;
+
+    switch (instr >> 12)
+    {
+    case ADD:
+    case AND:
+        if ((instr >> 5) & 0x1)
+            snprintf(buf, size, "%s R%d, R%d, #%d",
+                     instr >> 12 == ADD ? "ADD" : "AND", dr, sr1,
+                     sext(instr & 0x1f, 5));
+        else
+            snprintf(buf, size, "%s R%d, R%d, R%d",
+                     instr >> 12 == ADD ? "ADD" : "AND", dr, sr1, instr & 0x7);
+        break;
+    case BR:
+        if (!(instr & 0x0e00))
+            snprintf(buf, size, "NOP");
+        else
+            snprintf(buf, size, "BR%s%s%s x%04x", (instr & 0x800) ? "n" : "",
+                     (instr & 0x400) ? "z" : "", (instr & 0x200) ? "p" : "",
+                     (uint16_t)(next + sext(instr & 0x1ff, 9)));
+        break;
+    case JMP:
+        if (sr1 == 7)
+            snprintf(buf, size, "RET");
+        else
+            snprintf(buf, size, "JMP R%d", sr1);
+        break;
+    case JSR:
+        if ((instr >> 11) & 0x1)
+            snprintf(buf, size, "JSR x%04x",
+                     (uint16_t)(next + sext(instr & 0x7ff, 11)));
+        else
+            snprintf(buf, size, "JSRR R%d", sr1);
+        break;
+    case LD:
+    case LDI:
+    case LEA:
+    case ST:
+    case STI:
+        switch (instr >> 12)
+        {
+        case LD:
+            name = "LD";
+            break;
+        case LDI:
+            name = "LDI";
+            break;
+        case LEA:
+            name = "LEA";
+            break;
+        case ST:
+            name = "ST";
+            break;
+        default:
+            name = "STI";
+        }
+        snprintf(buf, size, "%s R%d, x%04x", name, dr,
+                 (uint16_t)(next + sext(instr & 0x1ff, 9)));
+        break;
+    case LDR:
+    case STR:
+        snprintf(buf, size, "%s R%d, R%d, #%d",
+                 instr >> 12 == LDR ? "LDR" : "STR", dr, sr1,
+                 sext(instr & 0x3f, 6));
+        break;
+    case NOT:
+        snprintf(buf, size, "NOT R%d, R%d", dr, sr1);
+        break;
+    case RTI:
+        snprintf(buf, size, "RTI");
+        break;
+    case TRAP:
+        name = trapname(instr & 0xff);
+        if (name)
+            snprintf(buf, size, "%s", name);
+        else
+            snprintf(buf, size, "TRAP x%02x", instr & 0xff);
+        break;
+    default:
+        snprintf(buf, size, ".FILL x%04x", instr);
+    }
+}
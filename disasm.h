@@ -0,0 +1,9 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void disasm(char *buf, size_t size, uint16_t pc, uint16_t instr);
+
+#endif
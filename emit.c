@@ -1,32 +1,202 @@
-#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
+#include "diag.h"
 #include "directive.h"
 #include "emit.h"
 #include "global.h"
 #include "instr.h"
-#include "lexeme.h"
+#include "lex.h"
 #include "op.h"
 #include "panic.h"
-#include "parse.h"
 #include "symbol.h"
 #include "token.h"
 
-/* Data file descriptor. */
-int lfd = 0;
+/* Words assembled but not yet written out: everything from the first word
+ * a pending fixup patches. With no output stream nothing is written and
+ * this is the whole image, starting with the origin. */
+word *image;
+int imagelen;
+static int imagecap;
+static long imagebase; /* words written before image[0] */
+static FILE *out;
 
-/* Output file descriptor */
-int ofd = 0;
+/* How an operand's value goes into the low bits of a word: as an offset
+ * from the word after it, a signed or unsigned number, or the whole word,
+ * which takes either */
+#define F_REL 0
+#define F_SIGNED 1
+#define F_UNSIGNED 2
+#define F_WORD 3
+
+typedef struct field_s
+{
+    const char *name;
+    int bits;
+    int kind;
+} field_t;
+
+#define PCOFF9 0
+#define PCOFF11 1
+#define IMM5 2
+#define OFFSET6 3
+#define TRAPVECT8 4
+#define WORD 5
+
+static const field_t fields[] = {
+    {"PCoffset9", 9, F_REL},     {"PCoffset11", 11, F_REL},
+    {"imm5", 5, F_SIGNED},       {"offset6", 6, F_SIGNED},
+    {"trapvect8", 8, F_UNSIGNED}, {"a word", 16, F_WORD},
+};
+
+/* An operand that refers to a symbol not defined yet. Its expression is
+ * kept in the pool and worked out again when that symbol is; if it has
+ * another undefined symbol in it, it then waits on that one. The value
+ * goes into the word at pos. */
+typedef struct fixup_s
+{
+    int sym;
+    long pos;
+    int lc;
+    int field;
+    int code, n; /* steps in the pool */
+    char *text;  /* as written, unless it is just sym */
+    pos_t at;    /* where it is */
+} fixup_t;
+
+static fixup_t *fixups;
+static int nfixups;
+static int fixupcap;
+
+/* Expressions of the pending fixups. It is emptied whenever they are all
+ * resolved. */
+static rpn_t *pool;
+static int npool;
+static int poolcap;
 
 /* Flag raised on .END directive */
 int done = 0;
 
+int emit_order = OBJ_LITTLE;
+
+void put(word w)
+{
+    word *p;
+
+    if (imagelen == imagecap)
+    {
+        p = realloc(image, (imagecap ? 2 * imagecap : 256) * INSTR_WIDTH);
+        if (!p)
+            panic("emit: out of memory");
+        image = p;
+        imagecap = imagecap ? 2 * imagecap : 256;
+    }
+    image[imagelen++] = w;
+}
+
+/* Value v of what, at lc, fitted to field f, reported if it does not fit */
+static word fit(int f, int v, int lc, const char *what, pos_t at)
+{
+    const field_t *fd = &fields[f];
+    int lo, hi;
+
+    if (fd->kind == F_REL)
+    {
+        v -= lc + 1;
+        if (v < -(1 << (fd->bits - 1)) || v >= 1 << (fd->bits - 1))
+            diag(at, "'%s' is out of range for %s (%d words away)", what,
+                 fd->name, v);
+        return v & ((1 << fd->bits) - 1);
+    }
+
+    lo = fd->kind == F_UNSIGNED ? 0 : -(1 << (fd->bits - 1));
+    hi = fd->kind == F_SIGNED ? (1 << (fd->bits - 1)) - 1
+                              : (1 << fd->bits) - 1;
+    if (v < lo || v > hi)
+        diag(at, "%d is out of range for %s (%d to %d)", v, fd->name, lo, hi);
+    return v & ((1 << fd->bits) - 1);
+}
+
+/* Put code with the value of instr's operand in field f, leaving a fixup
+ * if it refers to a symbol that is not defined yet */
+static void put_field(word code, const instr_t *instr, int f)
+{
+    const expr_t *ex = &instr->expr;
+    fixup_t *p;
+    rpn_t *q;
+    int sym;
+
+    if (EXPR_KNOWN(ex))
+    {
+        put(code |
+            fit(f, ex->code[0].val, instr->lc, ex->text, instr->argat));
+        return;
+    }
+    expr_eval(ex->code, ex->n, &sym);
+
+    if (nfixups == fixupcap)
+    {
+        p = realloc(fixups, (fixupcap ? 2 * fixupcap : 64) * sizeof(*p));
+        if (!p)
+            panic("emit: out of memory");
+        fixups = p;
+        fixupcap = fixupcap ? 2 * fixupcap : 64;
+    }
+    while (npool + ex->n > poolcap)
+    {
+        q = realloc(pool, (poolcap ? 2 * poolcap : 256) * sizeof(*q));
+        if (!q)
+            panic("emit: out of memory");
+        pool = q;
+        poolcap = poolcap ? 2 * poolcap : 256;
+    }
+
+    p = &fixups[nfixups++];
+    p->sym = sym;
+    p->pos = imagebase + imagelen;
+    p->lc = instr->lc;
+    p->field = f;
+    p->code = npool;
+    p->n = ex->n;
+    p->text = NULL;
+    p->at = instr->argat;
+    if (ex->n > 1 && !(p->text = malloc(strlen(ex->text) + 1)))
+        panic("emit: out of memory");
+    if (p->text)
+        strcpy(p->text, ex->text);
+    memcpy(pool + npool, ex->code, ex->n * sizeof(*pool));
+    npool += ex->n;
+    put(code);
+}
+
+/* Write out the words no pending fixup can reach */
+static void flush()
+{
+    long end = imagebase + imagelen;
+    int i, n;
+
+    if (!out)
+        return;
+    for (i = 0; i < nfixups; i++)
+        if (fixups[i].pos < end)
+            end = fixups[i].pos;
+
+    n = end - imagebase;
+    if (!n)
+        return;
+    /* Nothing patches these words again, so they are swapped in place */
+    if (emit_order != host_order())
+        swap16(image, n);
+    if (fwrite(image, INSTR_WIDTH, n, out) != (size_t)n)
+        panic("emit: unable to write output");
+    memmove(image, image + n, (imagelen - n) * INSTR_WIDTH);
+    imagelen -= n;
+    imagebase += n;
+}
+
 void emit_op(instr_t *instr)
 {
     op_t *op;
-    sym_t *sym;
     word code = 0;
 
     op = &optable[instr->p];
@@ -37,133 +207,111 @@ void emit_op(instr_t *instr)
     case ADD:
         code |= (instr->arg1 << 9) | (instr->arg2 << 6);
         if (instr->alt)
-            code |= instr->arg3;
+            put_field(code | (1 << 5), instr, IMM5);
         else
-            code |= (1 << 5) | (instr->arg3 & 0x1f);
-        write(ofd, &code, sizeof(code));
+            put(code | instr->arg3);
         break;
     case AND:
         code |= (instr->arg1 << 9) | (instr->arg2 << 6);
         if (instr->alt)
-            code |= instr->arg3;
+            put_field(code | (1 << 5), instr, IMM5);
         else
-            code |= (1 << 5) | (instr->arg3 & 0x1f);
-        write(ofd, &code, sizeof(code));
+            put(code | instr->arg3);
         break;
     case BR:
-        sym = &symtable[instr->arg1];
-        if (sym->offset == -1)
-            panic("undefined symbol '%s'", sym->lexeme);
         code |= op->attr << 9; /* nzp */
-        code |= (sym->offset - instr->lc - 1) & 0x1ff;
-        write(ofd, &code, sizeof(code));
+        put_field(code, instr, PCOFF9);
         break;
     case JMP:
         if (op->attr)
             code |= 0x1c0;
         else
             code |= instr->arg1 << 6;
-        write(ofd, &code, sizeof(code));
+        put(code);
         break;
     case JSR:
         if (instr->alt)
             code |= instr->arg1 << 6;
         else
         {
-            sym = &symtable[instr->arg1];
-            if (sym->offset == -1)
-                panic("undefined symbol '%s'", sym->lexeme);
-            code |= (0x1 << 11) | ((sym->offset - instr->lc - 1) & 0x3ff);
+            put_field(code | (0x1 << 11), instr, PCOFF11);
+            break;
         }
-        write(ofd, &code, sizeof(code));
+        put(code);
         break;
     case LD:
         code |= instr->arg1 << 9;
-        sym = &symtable[instr->arg2];
-        if (sym->offset == -1)
-            panic("undefined symbol '%s'", sym->lexeme);
-        code |= (sym->offset - instr->lc - 1) & 0x1ff;
-        write(ofd, &code, sizeof(code));
+        put_field(code, instr, PCOFF9);
         break;
     case LDI:
         code |= instr->arg1 << 9;
-        sym = &symtable[instr->arg2];
-        if (sym->offset == -1)
-            panic("undefined symbol '%s'", sym->lexeme);
-        code |= (sym->offset - instr->lc - 1) & 0x1ff;
-        write(ofd, &code, sizeof(code));
+        put_field(code, instr, PCOFF9);
         break;
     case LEA:
         code |= instr->arg1 << 9;
-        sym = &symtable[instr->arg2];
-        if (sym->offset == -1)
-            panic("undefined symbol '%s'", sym->lexeme);
-        code |= (sym->offset - instr->lc - 1) & 0x1ff;
-        write(ofd, &code, sizeof(code));
+        put_field(code, instr, PCOFF9);
         break;
     case LDR:
-        code |= (instr->arg1 << 9) | (instr->arg2 << 6) | instr->arg3;
-        write(ofd, &code, sizeof(code));
+        code |= (instr->arg1 << 9) | (instr->arg2 << 6);
+        put_field(code, instr, OFFSET6);
         break;
     case NOT:
         code |= (instr->arg1 << 9) | (instr->arg2 << 6) | 0x3f;
-        write(ofd, &code, sizeof(code));
+        put(code);
         break;
     case RTI:
         code |= 0x1c0;
-        write(ofd, &code, sizeof(code));
+        put(code);
         break;
     case ST:
         code |= instr->arg1 << 9;
-        sym = &symtable[instr->arg2];
-        if (sym->offset == -1)
-            panic("undefined symbol '%s'", sym->lexeme);
-        code |= (sym->offset - instr->lc - 1) & 0x1ff;
-        write(ofd, &code, sizeof(code));
+        put_field(code, instr, PCOFF9);
         break;
     case STI:
         code |= instr->arg1 << 9;
-        sym = &symtable[instr->arg2];
-        if (sym->offset == -1)
-            panic("undefined symbol '%s'", sym->lexeme);
-        code |= (sym->offset - instr->lc - 1) & 0x1ff;
-        write(ofd, &code, sizeof(code));
+        put_field(code, instr, PCOFF9);
         break;
     case STR:
-        code |= (instr->arg1 << 9) | (instr->arg2 << 6) | instr->arg3;
-        write(ofd, &code, sizeof(code));
+        code |= (instr->arg1 << 9) | (instr->arg2 << 6);
+        put_field(code, instr, OFFSET6);
         break;
     case TRAP:
         if (op->attr)
-            code |= op->attr;
+            put(code | op->attr);
         else
-            code |= instr->arg1;
-        write(ofd, &code, sizeof(code));
+            put_field(code, instr, TRAPVECT8);
         break;
     }
 }
 
 void emit_dir(instr_t *instr)
 {
-    word *n, c;
+    word c;
     char *s;
+    int n;
 
     switch (instr->p)
     {
     case ORIG:
+        put(instr->arg1);
+        break;
     case FILL:
-        write(ofd, &instr->arg1, INSTR_WIDTH);
+        put_field(0, instr, WORD);
         break;
     case BLKW:
-        n = calloc(instr->arg1, INSTR_WIDTH);
-        write(ofd, n, sizeof(*n));
-        free(n);
+        if (instr->arg1 < 0 || instr->arg1 > 0xffff)
+        {
+            diag(instr->argat, "invalid block size %d", instr->arg1);
+            instr->arg1 = 0; /* so the location counter stays put */
+        }
+        for (n = 0; n < instr->arg1; n++)
+            put(0);
         break;
     case STRINGZ:
-        s = &lextable[instr->arg1];
+        s = instr->str;
         while ((c = *s++))
-            write(ofd, &c, INSTR_WIDTH);
-        write(ofd, &c, INSTR_WIDTH); /* null word */
+            put(c);
+        put(c); /* null word */
         break;
     case END:
         done = 1;
@@ -171,28 +319,94 @@ void emit_dir(instr_t *instr)
     }
 }
 
-void emit()
+/* Write the symbol map, one "label xADDR" line per defined label */
+void emit_symbols(FILE *fp)
 {
-    instr_t instr;
+    int p;
 
-    lfd = open(DATAFILE, O_RDONLY);
-    if (lfd == -1)
-        panic("emit: unable to open data file");
+    for (p = 0; p <= lastsym; ++p)
+        if (symtable[p].defined == SYM_LABEL)
+            fprintf(fp, "%s x%04x\n", symtable[p].lexeme,
+                    symtable[p].offset & 0xffff);
+}
 
-    ofd = open(OUTFILE, O_WRONLY | O_CREAT | O_TRUNC, 0744);
-    if (ofd == -1)
-        panic("emit: unable to open output file");
+/* Start assembling into out, or into image if out is NULL */
+void emit_begin(FILE *fp)
+{
+    out = fp;
+    imagelen = 0;
+    imagebase = 0;
+    nfixups = 0;
+    npool = 0;
+    done = 0;
+}
 
-    while (!done && read(lfd, &instr, sizeof(instr)))
+/* Assemble one parsed line */
+void emit_line(instr_t *instr)
+{
+    if (done)
+        return;
+    if (instr->type == OP)
+        emit_op(instr);
+    else if (instr->type == DIRECTIVE)
+        emit_dir(instr);
+    else
+        panic("emit: unknown instruction type %d", instr->type);
+    flush();
+}
+
+/* Work out again every reference waiting on sym, which has just been
+ * defined, and patch in those that no longer wait on anything */
+void emit_label(int sym)
+{
+    fixup_t *f;
+    const char *what;
+    int i, v;
+
+    for (i = 0; i < nfixups;)
     {
-        if (instr.type == OP)
-            emit_op(&instr);
-        else if (instr.type == DIRECTIVE)
-            emit_dir(&instr);
-        else
-            panic("emit: unknown instruction type %d", instr.type);
+        f = &fixups[i];
+        if (f->sym != sym)
+        {
+            i++;
+            continue;
+        }
+        switch (expr_eval(pool + f->code, f->n, &v))
+        {
+        case -1:
+            f->sym = v;
+            i++;
+            continue;
+        case 0:
+            diag(f->at, "division by zero");
+            break;
+        default:
+            what = f->text ? f->text : symtable[sym].lexeme;
+            image[f->pos - imagebase] |= fit(f->field, v, f->lc, what, f->at);
+        }
+        free(f->text);
+        *f = fixups[--nfixups];
+    }
+    if (!nfixups)
+        npool = 0;
+}
+
+/* Finish the image. Every reference still pending is to a symbol that was
+ * never defined, and is reported; its field is left zero. */
+void emit_end()
+{
+    int i;
+
+    for (i = 0; i < nfixups; i++)
+    {
+        diag(fixups[i].at, "undefined symbol '%s'",
+             symtable[fixups[i].sym].lexeme);
+        free(fixups[i].text);
     }
+    nfixups = 0;
+    npool = 0;
 
-    close(ofd);
-    close(lfd);
+    flush();
+    if (out && fflush(out) == EOF)
+        panic("emit: unable to write output");
 }
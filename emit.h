@@ -1,6 +1,26 @@
 #ifndef EMIT_H
 #define EMIT_H
 
-void emit(void);
+#include "global.h"
+
+#include "instr.h"
+#include "swap.h"
+
+/* Assembled words not yet written out; all of them, starting with the
+ * origin, when there is no output stream */
+extern word *image;
+extern int imagelen;
+
+/* Set once .END is reached */
+extern int done;
+
+/* Byte order of the words written out, OBJ_LITTLE or OBJ_BIG */
+extern int emit_order;
+
+void emit_begin(FILE *fp);
+void emit_line(instr_t *instr);
+void emit_label(int sym);
+void emit_end(void);
+void emit_symbols(FILE *fp);
 
 #endif
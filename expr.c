@@ -0,0 +1,93 @@
+#include "expr.h"
+#include "symbol.h"
+#include "token.h"
+
+/* Apply op to a, and b if it takes two. Return 0 on division by zero,
+ * leaving val 0. Values are worked out in int and wrap as unsigned does;
+ * >> shifts the 16-bit word a in zeroes. */
+int expr_apply(int op, int a, int b, int *val)
+{
+    unsigned x = a, y = b;
+
+    *val = 0;
+    switch (op)
+    {
+    case NEG:
+        *val = -x;
+        break;
+    case '~':
+        *val = ~x;
+        break;
+    case '+':
+        *val = x + y;
+        break;
+    case '-':
+        *val = x - y;
+        break;
+    case '*':
+        *val = x * y;
+        break;
+    case '/':
+    case '%':
+        if (!b)
+            return 0;
+        if (b == -1)
+            *val = op == '/' ? -x : 0;
+        else
+            *val = op == '/' ? a / b : a % b;
+        break;
+    case '&':
+        *val = x & y;
+        break;
+    case '|':
+        *val = x | y;
+        break;
+    case '^':
+        *val = x ^ y;
+        break;
+    case SHL:
+        *val = y < 32 ? x << y : 0;
+        break;
+    case SHR:
+        *val = y < 16 ? (x & 0xffff) >> y : 0;
+        break;
+    }
+    return 1;
+}
+
+/* Work out an expression. Return 1 with its value in val; -1 with the
+ * first symbol in it that is not defined yet in val; or 0 on division by
+ * zero. */
+int expr_eval(const rpn_t *code, int n, int *val)
+{
+    int stack[EXPRMAX], sp = 0, i;
+
+    for (i = 0; i < n; i++)
+    {
+        switch (code[i].op)
+        {
+        case NUMBER:
+            stack[sp++] = code[i].val;
+            break;
+        case SYMBOL:
+            if (!symtable[code[i].val].defined)
+            {
+                *val = code[i].val;
+                return -1;
+            }
+            stack[sp++] = symtable[code[i].val].offset;
+            break;
+        case NEG:
+        case '~':
+            expr_apply(code[i].op, stack[sp - 1], 0, &stack[sp - 1]);
+            break;
+        default:
+            sp--;
+            if (!expr_apply(code[i].op, stack[sp - 1], stack[sp],
+                            &stack[sp - 1]))
+                return 0;
+        }
+    }
+    *val = stack[0];
+    return 1;
+}
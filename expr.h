@@ -0,0 +1,32 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+/* One step of an expression, kept in postfix order: a NUMBER or a SYMBOL
+ * to push, or an operator to apply to what was pushed */
+typedef struct rpn_s
+{
+    int op;
+    int val;
+} rpn_t;
+
+/* Unary minus; the other operators are their tokens */
+#define NEG -2
+
+/* Most steps an operand can take once folded */
+#define EXPRMAX 32
+
+/* An operand. What can be worked out as it is parsed is, so one that is
+ * known is a single NUMBER. */
+typedef struct expr_s
+{
+    int n;
+    rpn_t code[EXPRMAX];
+    char text[48]; /* as written, for listings and errors */
+} expr_t;
+
+#define EXPR_KNOWN(e) ((e)->n == 1 && (e)->code[0].op == NUMBER)
+
+int expr_apply(int op, int a, int b, int *val);
+int expr_eval(const rpn_t *code, int n, int *val);
+
+#endif
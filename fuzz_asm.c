@@ -0,0 +1,40 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "emit.h"
+#include "global.h"
+#include "panic.h"
+#include "parse.h"
+
+/* Assemble one input from memory. Malformed sources panic, which lands
+ * back here instead of exiting, so one process can take any number. */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    jmp_buf env;
+
+    if (size == 0)
+        return 0;
+
+    infile = fmemopen((void *)data, size, "r");
+    if (!infile)
+        return 0;
+    listing = 0;
+
+    panic_jmp = &env;
+    if (!setjmp(env))
+    {
+        emit_begin(NULL);
+        parse();
+        emit_end();
+    }
+    panic_jmp = NULL;
+
+    fclose(infile);
+    infile = NULL;
+
+    return 0;
+}
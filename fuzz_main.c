@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "panic.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/* Replay saved inputs through a fuzz entry point without libFuzzer */
+int main(int argc, char **argv)
+{
+    uint8_t *data = NULL, *p;
+    size_t len, cap = 0;
+    FILE *fp;
+    int i;
+
+    if (argc == 1)
+    {
+        fprintf(stderr, "Usage: %s <input>...\n", argv[0]);
+        exit(1);
+    }
+
+    for (i = 1; i < argc; i++)
+    {
+        fp = fopen(argv[i], "rb");
+        if (!fp)
+        {
+            fprintf(stderr, "%s: unable to open\n", argv[i]);
+            exit(1);
+        }
+        for (len = 0; !feof(fp) && !ferror(fp);
+             len += fread(data + len, 1, cap - len, fp))
+        {
+            if (len < cap)
+                continue;
+            p = realloc(data, cap ? 2 * cap : 4096);
+            if (!p)
+            {
+                fprintf(stderr, "%s: out of memory\n", argv[i]);
+                exit(1);
+            }
+            data = p;
+            cap = cap ? 2 * cap : 4096;
+        }
+        fclose(fp);
+
+        panic_msg[0] = '\0';
+        LLVMFuzzerTestOneInput(data, len);
+        printf("%s: %s\n", argv[i], panic_msg[0] ? panic_msg : "ok");
+    }
+
+    free(data);
+
+    return 0;
+}
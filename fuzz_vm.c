@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+
+#define BUDGET 10000
+
+static VM vm[2];
+
+/* Run one image on both engines; they must agree whenever the result
+ * does not depend on the host clock */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    int i, p, origin, status[2];
+
+    for (i = 0; i < 2; i++)
+    {
+        boot(&vm[i]);
+        origin = obj_load(&vm[i], data, size);
+        if (origin < 0)
+        {
+            poweroff(&vm[i]);
+            return 0;
+        }
+        vm[i].reg[PC] = origin;
+        vm[i].engine = i ? ENG_FUSED : ENG_INTERP;
+        headless(&vm[i], NULL, 0);
+        status[i] = run(&vm[i], BUDGET);
+    }
+
+    if (vm[0].tmr_next == 0 && vm[1].tmr_next == 0 && !vm[0].ien &&
+        !vm[1].ien)
+    {
+        if (status[0] != status[1] || vm[0].icount != vm[1].icount ||
+            memcmp(vm[0].reg, vm[1].reg, 8 * sizeof(uint16_t)) ||
+            vm[0].reg[PC] != vm[1].reg[PC] ||
+            psr_read(&vm[0]) != psr_read(&vm[1]) ||
+            vm[0].outbuf.len != vm[1].outbuf.len ||
+            (vm[0].outbuf.len &&
+             memcmp(vm[0].outbuf.data, vm[1].outbuf.data, vm[0].outbuf.len)))
+            abort();
+        for (p = 0; p < (DEVPAGE >> 8); p++)
+            if (memcmp(vm[0].page[p], vm[1].page[p],
+                       PAGE_WORDS * sizeof(uint16_t)))
+                abort();
+    }
+
+    poweroff(&vm[0]);
+    poweroff(&vm[1]);
+
+    return 0;
+}
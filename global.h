@@ -4,14 +4,12 @@
 #include <stdint.h>
 #include <stdio.h>
 
-#define DATAFILE "p.data"
-#define OUTFILE "o.lc3"
-
 typedef uint16_t word;
 
 #define INSTR_WIDTH sizeof(word)
 
-/* Input file object */
+/* Input file object, and its path if it has one */
 extern FILE *infile;
+extern const char *srcpath;
 
 #endif
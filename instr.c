@@ -2,7 +2,7 @@
 
 #include "directive.h"
 #include "instr.h"
-#include "lexeme.h"
+#include "lex.h"
 #include "op.h"
 #include "symbol.h"
 #include "token.h"
@@ -49,7 +49,7 @@ void instr_debug(instr_t *instr)
                    instr->alt ? "imm5" : "SR2", instr->arg3);
             break;
         case BR:
-            printf("\tPCoffset9: %s\n", symtable[instr->arg1].lexeme);
+            printf("\tPCoffset9: %s\n", instr->expr.text);
             break;
         case JMP:
             if (!op->attr)
@@ -59,13 +59,13 @@ void instr_debug(instr_t *instr)
             if (op->attr)
                 printf("\tBaseR: %d\n", instr->arg1);
             else
-                printf("\tPCoffset11: %s", symtable[instr->arg1].lexeme);
+                printf("\tPCoffset11: %s", instr->expr.text);
             break;
         case LD:
         case LDI:
         case LEA:
             printf("\tDR: %d\n\tPCoffset9: %s\n", instr->arg1,
-                   symtable[instr->arg2].lexeme);
+                   instr->expr.text);
             break;
         case LDR:
             printf("\tDR: %d\n\tBaseR: %d\n\toffset6: %d\n", instr->arg1,
@@ -77,7 +77,7 @@ void instr_debug(instr_t *instr)
         case ST:
         case STI:
             printf("\tSR: %d\n\tPCoffset9: %s\n", instr->arg1,
-                   symtable[instr->arg2].lexeme);
+                   instr->expr.text);
             break;
         case STR:
             printf("\tSR: %d\n\tBaseR: %d\n\toffset6: %d\n", instr->arg1,
@@ -98,11 +98,15 @@ void instr_debug(instr_t *instr)
         case ORIG:
         case FILL:
         case BLKW:
-            printf("\targ: 0x%x\n", instr->arg1);
+        case EQU:
+            if (EXPR_KNOWN(&instr->expr))
+                printf("\targ: 0x%x\n", instr->arg1);
+            else
+                printf("\targ: %s\n", instr->expr.text);
             break;
         case STRINGZ:
             printf("\targ: \"");
-            print_raw(&lextable[instr->arg1]);
+            print_raw(instr->str);
             printf("\"\n");
             break;
         case END:
@@ -1,6 +1,10 @@
 #ifndef INSTR_H
 #define INSTR_H
 
+#include "diag.h"
+#include "expr.h"
+#include "lex.h"
+
 typedef struct instr_s
 {
     int labelp;
@@ -11,6 +15,10 @@ typedef struct instr_s
     int arg1;
     int arg2;
     int arg3;
+    pos_t at;    /* where the line starts */
+    pos_t argat; /* where its label or number operand starts */
+    expr_t expr; /* and what it is */
+    char str[STRMAX]; /* the string of a .STRINGZ */
 } instr_t;
 
 void instr_debug(instr_t *instr);
@@ -0,0 +1,279 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "core.h"
+#include "smp.h"
+
+/* Trace ring and the descriptor it is dumped to */
+trace_t *trace;
+int tracefd = -1;
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: lc3 [-i input] [-o output] [-x expected] "
+                    "[-b budget] [-t trace] [-c coverage] [-e interp|fused] "
+                    "[-E little|big] [-p harts] [-r log | -R log] "
+                    "[-L snapshot] [-S snapshot] <file>\n"
+                    "       more than one hart always runs interp\n");
+    exit(1);
+}
+
+/* Dump the trace when the process is killed or faults */
+void ondeath(int sig)
+{
+    trace_dump(trace, tracefd);
+    raise(sig);
+}
+
+void trace_open(const char *path)
+{
+    struct sigaction sa;
+    int sigs[] = {SIGINT, SIGTERM, SIGHUP, SIGSEGV, SIGBUS, SIGABRT};
+    unsigned i;
+
+    trace = calloc(1, sizeof(*trace));
+    tracefd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (!trace || tracefd == -1)
+    {
+        fprintf(stderr, "unable to open trace '%s'\n", path);
+        exit(1);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ondeath;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+        sigaction(sigs[i], &sa, NULL);
+}
+
+/* Read a whole file into memory */
+uint8_t *slurp(const char *path, size_t *len)
+{
+    buf_t b = {0};
+    int c;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "unable to open '%s'\n", path);
+        exit(1);
+    }
+    while ((c = getc(fp)) != EOF)
+        buf_put(&b, c);
+    fclose(fp);
+
+    *len = b.len;
+    return b.data;
+}
+
+int main(int argc, char **argv)
+{
+    VM *harts, *vm;
+    int i, status, nharts = 1, hstatus[MAXHARTS];
+    char *inpath = NULL, *outpath = NULL, *tracepath = NULL, *wantpath = NULL,
+         *covpath = NULL, *recpath = NULL, *replaypath = NULL,
+         *loadpath = NULL, *savepath = NULL;
+    uint8_t *input = NULL, *want = NULL;
+    size_t inlen = 0, wantlen = 0, matched;
+    uint16_t fault;
+    uint64_t budget = 0, icount;
+    int engine = ENG_INTERP;
+    rlog_t rlog = {0};
+    FILE *fp;
+
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0)
+            inpath = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0)
+            outpath = argv[++i];
+        else if (strcmp(argv[i], "-x") == 0)
+            wantpath = argv[++i];
+        else if (strcmp(argv[i], "-b") == 0)
+            budget = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-t") == 0)
+            tracepath = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0)
+            covpath = argv[++i];
+        else if (strcmp(argv[i], "-e") == 0)
+            engine = strcmp(argv[++i], "fused") == 0 ? ENG_FUSED : ENG_INTERP;
+        else if (strcmp(argv[i], "-E") == 0)
+            obj_order = strcmp(argv[++i], "big") == 0 ? OBJ_BIG : OBJ_LITTLE;
+        else if (strcmp(argv[i], "-p") == 0)
+            nharts = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0)
+            recpath = argv[++i];
+        else if (strcmp(argv[i], "-R") == 0)
+            replaypath = argv[++i];
+        else if (strcmp(argv[i], "-L") == 0)
+            loadpath = argv[++i];
+        else if (strcmp(argv[i], "-S") == 0)
+            savepath = argv[++i];
+        else
+            usage();
+    }
+    if (i != argc - 1 || nharts < 1 || nharts > MAXHARTS)
+        usage();
+
+    /* Harts racing on shared memory cannot be replayed */
+    if ((recpath && replaypath) ||
+        ((recpath || replaypath || loadpath || savepath) && nharts > 1))
+        usage();
+
+    harts = calloc(nharts, sizeof(*harts));
+    if (!harts)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    vm = harts;
+
+    boot(vm);
+    vm->reg[PC] = read_obj(vm, argv[i]);
+    vm->engine = engine;
+
+    /* Scripted input or captured output runs the machine headless */
+    if (inpath || outpath)
+    {
+        if (inpath)
+            input = slurp(inpath, &inlen);
+        headless(vm, input, inlen);
+    }
+
+    /* Grading stops the program at its first wrong byte of output */
+    if (wantpath)
+    {
+        want = slurp(wantpath, &wantlen);
+        grade(vm, want, wantlen);
+    }
+
+    if (tracepath)
+    {
+        trace_open(tracepath);
+        vm->trace = trace;
+    }
+
+    /* Coverage adds to whatever earlier runs saved */
+    if (covpath)
+    {
+        vm->cov = calloc(1, sizeof(*vm->cov));
+        if (!vm->cov)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        cov_load(vm->cov, covpath);
+    }
+
+    /* Record the input, or replay it, from boot or a snapshot */
+    if (recpath && rlog_record(vm, &rlog, recpath) == -1)
+    {
+        fprintf(stderr, "unable to open '%s'\n", recpath);
+        exit(1);
+    }
+    if (replaypath && rlog_replay(vm, &rlog, replaypath) == -1)
+    {
+        fprintf(stderr, "'%s' is not an input log\n", replaypath);
+        exit(1);
+    }
+    if (loadpath && snap_load(vm, loadpath) == -1)
+    {
+        fprintf(stderr, "'%s' is not a snapshot of this run\n", loadpath);
+        exit(1);
+    }
+
+    /* Further harts share hart 0's memory and display */
+    if (nharts > 1)
+    {
+        smp_boot(harts, nharts);
+        status = smp_run(harts, nharts, budget, hstatus);
+    }
+    else
+        status = run(vm, budget);
+
+    /* The ring covers the lead-up to a halt, exception or budget stop */
+    if (trace)
+    {
+        trace_dump(trace, tracefd);
+        close(tracefd);
+        free(trace);
+    }
+
+    if (vm->headless)
+    {
+        fp = outpath ? fopen(outpath, "wb") : stdout;
+        if (!fp)
+        {
+            fprintf(stderr, "unable to open '%s'\n", outpath);
+            exit(1);
+        }
+        for (i = 0; i < nharts; i++)
+            fwrite(harts[i].outbuf.data, 1, harts[i].outbuf.len, fp);
+        if (outpath)
+            fclose(fp);
+    }
+
+    if (savepath && snap_save(vm, savepath) == -1)
+    {
+        fprintf(stderr, "unable to write '%s'\n", savepath);
+        exit(1);
+    }
+    if ((recpath || replaypath) && rlog_close(&rlog) == -1)
+    {
+        fprintf(stderr, "unable to write '%s'\n", recpath);
+        exit(1);
+    }
+
+    if (covpath)
+    {
+        if (cov_save(vm->cov, covpath) == -1)
+        {
+            fprintf(stderr, "unable to write '%s'\n", covpath);
+            exit(1);
+        }
+        free(vm->cov);
+    }
+
+    /* What the report needs, read before the machines' memory goes */
+    matched = vm->want.pos;
+    icount = vm->icount;
+    fault = peek(vm, vm->reg[PC] - 1);
+    for (i = nharts; i-- > 0;)
+        poweroff(&harts[i]);
+    free(input);
+    free(want);
+
+    switch (status)
+    {
+    case VM_BUDGET:
+        fprintf(stderr, "instruction budget exhausted\n");
+        exit(2);
+    case VM_ILLEGAL:
+        fprintf(stderr, "illegal opcode exception: \\x%4x\n",
+                fault >> 12);
+        exit(1);
+    case VM_PRIV:
+        fprintf(stderr, "privilege mode exception\n");
+        exit(1);
+    case VM_MISMATCH:
+        fprintf(stderr, "output differs from expected at byte %zu\n",
+                matched);
+        exit(3);
+    case VM_DIVERGED:
+        fprintf(stderr, "replay diverged from the log at instruction %llu\n",
+                (unsigned long long)icount);
+        exit(4);
+    }
+
+    free(harts);
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aot.h"
+#include "core.h"
+
+/* Driver for a program translated with lc3c */
+int main(int argc, char **argv)
+{
+    VM vm;
+    int status, verbose = argc == 2 && strcmp(argv[1], "-v") == 0;
+    struct timespec t0, t1;
+    double t;
+
+    if (argc > 1 && !verbose)
+    {
+        fprintf(stderr, "Usage: %s [-v]\n", argv[0]);
+        exit(1);
+    }
+
+    boot(&vm);
+    aot_load(&vm);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    status = aot_run(&vm);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    fflush(stdout);
+
+    if (verbose)
+    {
+        t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        fprintf(stderr, "%llu instructions in %.4f s, %.2f MIPS\n",
+                (unsigned long long)vm.icount, t, vm.icount / t / 1e6);
+    }
+
+    poweroff(&vm);
+
+    switch (status)
+    {
+    case VM_ILLEGAL:
+        fprintf(stderr, "illegal opcode exception\n");
+        exit(1);
+    case VM_PRIV:
+        fprintf(stderr, "privilege mode exception\n");
+        exit(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "core.h"
+
+const char *status_name[] = {"halt",  "budget", "illegal",  "priv",
+                             "break", "watch",  "stop",     "mismatch",
+                             "diverged"};
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: lc3batch [-j jobs] [-b budget] [-x suffix] "
+                    "[-c coverage] [-e interp|fused|lockstep] "
+                    "<file> <input>...\n");
+    exit(1);
+}
+
+/* Read a whole file into memory */
+uint8_t *slurp(const char *path, size_t *len)
+{
+    buf_t b = {0};
+    int c;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "unable to open '%s'\n", path);
+        exit(1);
+    }
+    while ((c = getc(fp)) != EOF)
+        buf_put(&b, c);
+    fclose(fp);
+
+    *len = b.len;
+    return b.data;
+}
+
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Run one image against every input, writing each input's display output
+ * next to it as <input>.out. With -x, each run is graded against
+ * <input><suffix> and stops at its first wrong byte. */
+int main(int argc, char **argv)
+{
+    VM tmpl;
+    job_t *jobs;
+    int i, n, nthreads = sysconf(_SC_NPROCESSORS_ONLN), engine = ENG_INTERP,
+              npass = 0;
+    const char *suffix = NULL, *covpath = NULL;
+    uint64_t budget = 0, icount = 0, nlock = 0;
+    char path[4096];
+    double t;
+    FILE *fp;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            nthreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            budget = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+            suffix = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            covpath = argv[++i];
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "fused") == 0)
+                engine = ENG_FUSED;
+            else if (strcmp(argv[i], "lockstep") == 0)
+                engine = ENG_LOCKSTEP;
+            else
+                engine = ENG_INTERP;
+        }
+        else
+            usage();
+    }
+    if (argc - i < 2 || nthreads < 1)
+        usage();
+
+    /* Setup is paid once; every run starts from a clone */
+    boot(&tmpl);
+    tmpl.reg[PC] = read_obj(&tmpl, argv[i++]);
+    tmpl.engine = engine;
+    headless(&tmpl, NULL, 0);
+
+    /* Coverage adds to whatever earlier runs saved */
+    if (covpath)
+    {
+        tmpl.cov = calloc(1, sizeof(*tmpl.cov));
+        if (!tmpl.cov)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        cov_load(tmpl.cov, covpath);
+    }
+
+    n = argc - i;
+    jobs = calloc(n, sizeof(*jobs));
+    if (!jobs)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (n = 0; i < argc; i++, n++)
+    {
+        jobs[n].in = slurp(argv[i], &jobs[n].inlen);
+        if (suffix)
+        {
+            snprintf(path, sizeof(path), "%s%s", argv[i], suffix);
+            jobs[n].want = slurp(path, &jobs[n].wantlen);
+        }
+    }
+
+    t = now();
+    if (batch_run(&tmpl, jobs, n, budget, nthreads) == -1)
+    {
+        fprintf(stderr, "unable to start threads\n");
+        exit(1);
+    }
+    t = now() - t;
+
+    for (i = 0; i < n; i++)
+    {
+        snprintf(path, sizeof(path), "%s.out", argv[argc - n + i]);
+        fp = fopen(path, "wb");
+        if (!fp)
+        {
+            fprintf(stderr, "unable to open '%s'\n", path);
+            exit(1);
+        }
+        fwrite(jobs[i].out.data, 1, jobs[i].out.len, fp);
+        fclose(fp);
+
+        printf("%-32s %-8s %12llu %10zu", argv[argc - n + i],
+               status_name[jobs[i].status],
+               (unsigned long long)jobs[i].icount, jobs[i].out.len);
+        if (jobs[i].status == VM_MISMATCH)
+            printf("  at byte %zu", jobs[i].matched);
+        printf("\n");
+        npass += suffix && jobs[i].status == VM_HALT;
+        icount += jobs[i].icount;
+        nlock += jobs[i].nlock;
+    }
+    fprintf(stderr, "%d runs in %.4f s on %d threads\n", n, t,
+            nthreads < n ? nthreads : n);
+    if (suffix)
+        fprintf(stderr, "%d of %d runs match\n", npass, n);
+    if (engine == ENG_LOCKSTEP && icount)
+        fprintf(stderr, "%.1f%% of instructions ran in lockstep\n",
+                100.0 * nlock / icount);
+
+    if (covpath && cov_save(tmpl.cov, covpath) == -1)
+    {
+        fprintf(stderr, "unable to write '%s'\n", covpath);
+        exit(1);
+    }
+    free(tmpl.cov);
+
+    for (i = 0; i < n; i++)
+    {
+        free((uint8_t *)jobs[i].in);
+        free((uint8_t *)jobs[i].want);
+    }
+    batch_free(jobs, n);
+    free(jobs);
+    poweroff(&tmpl);
+
+    return 0;
+}
@@ -0,0 +1,550 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "disasm.h"
+#include "op.h"
+#include "symmap.h"
+
+/* Ahead-of-time translator: turns an image into a C function with one
+ * labeled block per basic block and direct gotos between them. */
+
+/* Per-address analysis flags */
+#define A_CODE 0x1   /* reached as an instruction */
+#define A_LEADER 0x2 /* starts a basic block */
+#define A_SEEN 0x4   /* queued for the walk */
+#define A_DATA 0x8   /* loaded, stored or taken the address of by code */
+
+VM vm;
+symmap_t syms;
+uint8_t flags[0x10000];
+uint8_t obj[2 * 0x10001];
+uint16_t image[0x10000];
+uint16_t origin;
+unsigned imagelen;
+
+uint16_t worklist[0x10000];
+int nwork;
+
+/* Instructions after the current one in its block, already counted */
+int rest;
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: lc3c [-s symbols] [-o out.c] <file>\n");
+    exit(1);
+}
+
+/* Addresses we are willing to translate: the image itself and whatever
+ * boot() put in memory, short of the device page. */
+int translatable(uint16_t a)
+{
+    if (a >= DEVPAGE)
+        return 0;
+    if (a >= origin && a - origin < imagelen)
+        return 1;
+    return MEM(&vm, a) != 0;
+}
+
+void leader(uint16_t a)
+{
+    if (!translatable(a))
+        return;
+    flags[a] |= A_LEADER;
+    if (!(flags[a] & A_SEEN))
+    {
+        flags[a] |= A_SEEN;
+        worklist[nwork++] = a;
+    }
+}
+
+void follow(uint16_t a)
+{
+    if (!translatable(a) || (flags[a] & A_SEEN))
+        return;
+    flags[a] |= A_SEEN;
+    worklist[nwork++] = a;
+}
+
+/* Recover the control flow graph from the entry points */
+void walk(void)
+{
+    uint16_t a, instr, next;
+
+    while (nwork)
+    {
+        a = worklist[--nwork];
+        instr = MEM(&vm, a);
+        next = a + 1;
+        flags[a] |= A_CODE;
+
+        switch (instr >> 12)
+        {
+        case BR:
+            if ((instr >> 9) & 0x7)
+                leader(next + sext(instr & 0x1ff, 9));
+            if (((instr >> 9) & 0x7) != 0x7)
+                leader(next);
+            break;
+        case JMP:
+        case RTI:
+            break;
+        case JSR:
+            if ((instr >> 11) & 0x1)
+                leader(next + sext(instr & 0x7ff, 11));
+            leader(next); /* return site */
+            break;
+        case TRAP:
+            leader(next);
+            break;
+        case RES:
+            break;
+        default:
+            follow(next);
+        }
+    }
+}
+
+/* Mark the words code reaches with PC-relative loads, stores and LEA */
+void mark_data(void)
+{
+    unsigned a;
+    uint16_t instr;
+
+    for (a = 0; a < 0x10000; a++)
+    {
+        if (!(flags[a] & A_CODE))
+            continue;
+        instr = MEM(&vm, a);
+        switch (instr >> 12)
+        {
+        case LD:
+        case LDI:
+        case LEA:
+        case ST:
+        case STI:
+            flags[(uint16_t)(a + 1 + sext(instr & 0x1ff, 9))] |= A_DATA;
+        }
+    }
+}
+
+/* Whether a label names code the walk could not reach, such as a routine
+ * called only through JSRR or a jump table. Labels on what code loads or
+ * stores are data, as are words that do not read as instructions: zeros,
+ * characters and small numbers, which decode as BR without a condition,
+ * and anything reserved. Translating data would send every store to it
+ * back to the interpreter. */
+int code_label(uint16_t a)
+{
+    uint16_t instr = MEM(&vm, a);
+
+    if (!translatable(a) || (flags[a] & (A_SEEN | A_DATA)))
+        return 0;
+    switch (instr >> 12)
+    {
+    case BR:
+        return ((instr >> 9) & 0x7) != 0;
+    case JMP:
+        return !(instr & 0xe3f);
+    case NOT:
+        return (instr & 0x3f) == 0x3f;
+    case RTI:
+    case RES:
+        return 0;
+    case TRAP:
+        return !(instr & 0xf00);
+    }
+    return 1;
+}
+
+/* Whether the instruction at a ends its block */
+int ends_block(uint16_t instr)
+{
+    switch (instr >> 12)
+    {
+    case BR:
+        return ((instr >> 9) & 0x7) == 0x7;
+    case JMP:
+    case JSR:
+    case RTI:
+    case TRAP:
+    case RES:
+        return 1;
+    }
+    return 0;
+}
+
+/* Instructions from leader a up to the end of its block */
+int blocklen(uint16_t a)
+{
+    int n = 0;
+
+    do
+        n++;
+    while (!ends_block(MEM(&vm, a)) && !(flags[a + 1] & A_LEADER) &&
+           (flags[++a] & A_CODE));
+    return n;
+}
+
+void emit_bitmap(FILE *fp, const char *name, uint8_t mask)
+{
+    int i, j;
+    uint8_t byte;
+
+    fprintf(fp, "static const uint8_t %s[8192] = {", name);
+    for (i = 0; i < 8192; i++)
+    {
+        byte = 0;
+        for (j = 0; j < 8; j++)
+            if (flags[i * 8 + j] & mask)
+                byte |= 1 << j;
+        if (byte)
+            fprintf(fp, "\n    [%d] = 0x%02x,", i, byte);
+    }
+    fprintf(fp, "};\n\n");
+}
+
+/* Whether the flags set by the instruction at a are overwritten before
+ * anything in its block can read them. Loads may read PSRR and stores may
+ * hand over to the interpreter, so both count as readers. */
+int cc_dead(uint16_t a)
+{
+    uint16_t instr;
+
+    while (!ends_block(MEM(&vm, a)) && !(flags[a + 1] & A_LEADER) &&
+           (flags[++a] & A_CODE))
+    {
+        instr = MEM(&vm, a);
+        switch (instr >> 12)
+        {
+        case ADD:
+        case AND:
+        case NOT:
+        case LEA:
+            return 1;
+        case LD:
+            if ((uint16_t)(a + 1 + sext(instr & 0x1ff, 9)) < DEVPAGE)
+                return 1;
+            return 0;
+        default:
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/* Jump straight to a translated block, else through the dispatcher */
+void emit_jump(FILE *fp, const char *indent, uint16_t target)
+{
+    if ((flags[target] & A_LEADER) && (flags[target] & A_CODE))
+        fprintf(fp, "%sgoto L%04x;\n", indent, target);
+    else
+        fprintf(fp, "%sGOTO(0x%04x);\n", indent, target);
+}
+
+void emit_instr(FILE *fp, uint16_t a)
+{
+    uint16_t instr = MEM(&vm, a), next = a + 1;
+    int dr = (instr >> 9) & 0x7, sr1 = (instr >> 6) & 0x7, cond;
+    uint16_t target;
+
+    switch (instr >> 12)
+    {
+    case ADD:
+    case AND:
+        if ((instr >> 5) & 0x1)
+            fprintf(fp, "    R[%d] = R[%d] %c 0x%04x;\n", dr, sr1,
+                    instr >> 12 == ADD ? '+' : '&',
+                    (uint16_t)sext(instr & 0x1f, 5));
+        else
+            fprintf(fp, "    R[%d] = R[%d] %c R[%d];\n", dr, sr1,
+                    instr >> 12 == ADD ? '+' : '&', instr & 0x7);
+        break;
+    case NOT:
+        fprintf(fp, "    R[%d] = ~R[%d];\n", dr, sr1);
+        break;
+    case LEA:
+        fprintf(fp, "    R[%d] = 0x%04x;\n", dr,
+                (uint16_t)(next + sext(instr & 0x1ff, 9)));
+        break;
+    case LD:
+        fprintf(fp, "    R[%d] = mem_read(vm, 0x%04x);\n", dr,
+                (uint16_t)(next + sext(instr & 0x1ff, 9)));
+        break;
+    case LDI:
+        fprintf(fp, "    R[%d] = mem_read(vm, mem_read(vm, 0x%04x));\n", dr,
+                (uint16_t)(next + sext(instr & 0x1ff, 9)));
+        break;
+    case LDR:
+        fprintf(fp, "    R[%d] = mem_read(vm, R[%d] + 0x%04x);\n", dr, sr1,
+                (uint16_t)sext(instr & 0x3f, 6));
+        break;
+    case ST:
+        fprintf(fp, "    STORE(0x%04x, R[%d], 0x%04x, %d);\n",
+                (uint16_t)(next + sext(instr & 0x1ff, 9)), dr, next, rest);
+        break;
+    case STI:
+        fprintf(fp, "    STORE(mem_read(vm, 0x%04x), R[%d], 0x%04x, %d);\n",
+                (uint16_t)(next + sext(instr & 0x1ff, 9)), dr, next, rest);
+        break;
+    case STR:
+        fprintf(fp,
+                "    STORE((uint16_t)(R[%d] + 0x%04x), R[%d], 0x%04x, %d);\n",
+                sr1, (uint16_t)sext(instr & 0x3f, 6), dr, next, rest);
+        break;
+    case BR:
+        cond = (instr >> 9) & 0x7;
+        target = next + sext(instr & 0x1ff, 9);
+        if (!cond)
+            break;
+        if (cond == 0x7)
+        {
+            emit_jump(fp, "    ", target);
+        }
+        else
+        {
+            fprintf(fp, "    if (CC_NZP(vm->cc) & %d)\n", cond);
+            emit_jump(fp, "        ", target);
+        }
+        break;
+    case JMP:
+        fprintf(fp, "    R[PC] = R[%d];\n    goto dispatch;\n", sr1);
+        break;
+    case JSR:
+        if ((instr >> 11) & 0x1)
+        {
+            fprintf(fp, "    R[R7] = 0x%04x;\n", next);
+            emit_jump(fp, "    ", next + sext(instr & 0x7ff, 11));
+        }
+        else
+        {
+            fprintf(fp,
+                    "    R[PC] = R[%d];\n    R[R7] = 0x%04x;\n"
+                    "    goto dispatch;\n",
+                    sr1, next);
+        }
+        break;
+    case TRAP:
+        fprintf(fp,
+                "    R[R7] = 0x%04x;\n    R[PC] = MEM(vm, 0x%02x);\n"
+                "    goto dispatch;\n",
+                next, instr & 0xff);
+        break;
+    default:
+        /* RTI and exceptions are left to the interpreter */
+        fprintf(fp, "    R[PC] = 0x%04x;\n    vm->icount--;\n"
+                    "    goto interp;\n",
+                a);
+        return;
+    }
+
+    switch (instr >> 12)
+    {
+    case ADD:
+    case AND:
+    case NOT:
+    case LEA:
+    case LD:
+    case LDI:
+    case LDR:
+        if (!cc_dead(a))
+            fprintf(fp, "    SETCC(R[%d]);\n", dr);
+    }
+}
+
+void emit(FILE *fp, const char *path)
+{
+    unsigned i;
+    uint16_t a;
+    int n, col;
+    char text[32];
+    const symdef_t *sym;
+
+    fprintf(fp, "/* Translated by lc3c from %s */\n\n", path);
+    fprintf(fp, "#include <stdint.h>\n\n"
+                "#include \"aot.h\"\n#include \"core.h\"\n\n");
+    fprintf(fp, "#define R vm->reg\n\n");
+    fprintf(fp, "#define SETCC(v) (vm->cc = (v))\n\n");
+    fprintf(fp, "#define BIT(map, a) \\\n"
+                "    (((map)[(a) >> 3] >> ((a) & 0x7)) & 0x1)\n\n");
+
+    /* Stores that halt, stop the machine, enable interrupts or counters or
+     * rewrite translated code hand the rest of the run to the interpreter.
+     * Blocks are counted up front, so leaving one early gives back the
+     * instructions not yet run. */
+    fprintf(fp, "#define STORE(a, v, next, rest) \\\n"
+                "    do \\\n"
+                "    { \\\n"
+                "        uint16_t a_ = (a); \\\n"
+                "        mem_write(vm, a_, (v)); \\\n"
+                "        if (!*vm->mcr || vm->stop || vm->ien || \\\n"
+                "            vm->pmon || BIT(code, a_)) \\\n"
+                "        { \\\n"
+                "            vm->icount -= (rest); \\\n"
+                "            R[PC] = (next); \\\n"
+                "            if (vm->stop) \\\n"
+                "                return vm->stop; \\\n"
+                "            if (!*vm->mcr) \\\n"
+                "                return VM_HALT; \\\n"
+                "            return run(vm, 0); \\\n"
+                "        } \\\n"
+                "    } while (0)\n\n");
+
+    /* Transfers to targets we did not translate */
+    fprintf(fp, "#define GOTO(a) \\\n"
+                "    do \\\n"
+                "    { \\\n"
+                "        R[PC] = (a); \\\n"
+                "        goto dispatch; \\\n"
+                "    } while (0)\n\n");
+
+    emit_bitmap(fp, "code", A_CODE);
+    emit_bitmap(fp, "entry", A_LEADER);
+
+    fprintf(fp, "static const uint16_t image[%u] = {", imagelen);
+    for (i = 0, col = 0; i < imagelen; i++, col++)
+        fprintf(fp, "%s0x%04x,", col % 8 ? " " : "\n    ", image[i]);
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "/* Load the image into a booted machine */\n"
+                "void aot_load(VM *vm)\n{\n"
+                "    mem_load(vm, 0x%04x, image, %u);\n"
+                "    R[PC] = 0x%04x;\n}\n\n",
+            origin, imagelen, origin);
+
+    fprintf(fp, "/* Run until the machine halts or raises an exception */\n"
+                "int aot_run(VM *vm)\n{\n"
+                "    int status;\n\n"
+                "    if (vm->ien || vm->pmon)\n        return run(vm, 0);\n\n");
+
+    fprintf(fp, "dispatch:\n    if (!*vm->mcr)\n        return VM_HALT;\n"
+                "    switch (R[PC])\n    {\n");
+    for (i = 0; i < 0x10000; i++)
+        if (flags[i] & A_LEADER && flags[i] & A_CODE)
+            fprintf(fp, "    case 0x%04x:\n        goto L%04x;\n", i, i);
+    fprintf(fp, "    default:\n        goto interp;\n    }\n\n");
+
+    /* Unknown targets are interpreted one instruction at a time until
+     * control comes back to a block we know */
+    fprintf(fp, "interp:\n"
+                "    do\n    {\n"
+                "        status = run(vm, 1);\n"
+                "        if (status != VM_BUDGET)\n"
+                "            return status;\n"
+                "        if (vm->ien || vm->pmon)\n"
+                "            return run(vm, 0);\n"
+                "    } while (!BIT(entry, R[PC]) || !BIT(code, R[PC]));\n"
+                "    goto dispatch;\n");
+
+    for (i = 0; i < 0x10000; i++)
+    {
+        a = i;
+        if (!(flags[a] & A_CODE))
+            continue;
+
+        if (flags[a] & A_LEADER)
+        {
+            sym = symmap_near(&syms, a);
+            n = blocklen(a);
+            rest = n;
+            fprintf(fp, "\n");
+            if (sym && sym->addr == a)
+                fprintf(fp, "    /* %s */\n", sym->name);
+            fprintf(fp, "L%04x:\n    vm->icount += %d;\n", a, n);
+        }
+
+        rest--;
+        disasm(text, sizeof(text), a, MEM(&vm, a));
+        fprintf(fp, "    /* x%04x  %s */\n", a, text);
+        emit_instr(fp, a);
+
+        /* Fall out of the translated region */
+        if (!ends_block(MEM(&vm, a)) && !(flags[(uint16_t)(a + 1)] & A_CODE))
+            emit_jump(fp, "    ", a + 1);
+    }
+
+    fprintf(fp, "}\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *sympath = NULL, *outpath = NULL;
+    char path[256], *dot;
+    uint16_t *w;
+    size_t len = 0;
+    int i, v;
+    FILE *fp, *out;
+
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+            sympath = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0)
+            outpath = argv[++i];
+        else
+            usage();
+    }
+    if (i != argc - 1)
+        usage();
+
+    fp = fopen(argv[i], "rb");
+    if (fp)
+    {
+        len = fread(obj, 1, sizeof(obj), fp);
+        fclose(fp);
+    }
+    if (len < 2)
+    {
+        fprintf(stderr, "unable to read '%s'\n", argv[i]);
+        exit(1);
+    }
+    w = obj_words(obj, len);
+    origin = w[0];
+    imagelen = len / 2 - 1;
+    if (imagelen > 0x10000u - origin)
+        imagelen = 0x10000 - origin;
+    memcpy(image, w + 1, imagelen * sizeof(*image));
+    free(w);
+
+    if (!sympath)
+    {
+        snprintf(path, sizeof(path), "%s", argv[i]);
+        dot = strrchr(path, '.');
+        if (dot && strlen(dot) == 4)
+            strcpy(dot, ".sym");
+        sympath = path;
+    }
+    symmap_load(&syms, sympath);
+
+    boot(&vm);
+    mem_load(&vm, origin, image, imagelen);
+
+    /* Entry points: the origin and every trap routine, then the labels
+     * that name code reached only through registers */
+    leader(origin);
+    for (v = GETC; v <= HALT; v++)
+        leader(MEM(&vm, v));
+    walk();
+    mark_data();
+    for (v = 0; v < syms.n; v++)
+        if (code_label(syms.sym[v].addr))
+            leader(syms.sym[v].addr);
+    walk();
+
+    out = outpath ? fopen(outpath, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "unable to open '%s'\n", outpath);
+        exit(1);
+    }
+    emit(out, argv[i]);
+    if (outpath)
+        fclose(out);
+
+    symmap_free(&syms);
+    poweroff(&vm);
+
+    return 0;
+}
@@ -0,0 +1,389 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "disasm.h"
+#include "op.h"
+#include "symmap.h"
+
+/* A stretch of code reported on its own: from a label, a trap routine's
+ * entry or the load address up to the next one */
+typedef struct region_s
+{
+    char name[SYMNAME];
+    uint16_t start;
+    uint32_t end;
+} region_t;
+
+#define W_CODE 0x1 /* reached as an instruction */
+#define W_SEEN 0x2 /* queued for the walk */
+#define W_DATA 0x4 /* loaded, stored or taken the address of by code */
+
+static const char *trapname[] = {"GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT"};
+
+static uint8_t flags[0x10000];
+static uint16_t worklist[0x10000];
+static int nwork;
+static uint32_t image_start, image_end;
+
+void usage(void)
+{
+    fprintf(stderr,
+            "Usage: lc3cov [-v] [-s symbols] <file> <coverage>...\n");
+    exit(1);
+}
+
+/* Read a whole file into memory */
+uint8_t *slurp(const char *path, size_t *len)
+{
+    buf_t b = {0};
+    int c;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "unable to open '%s'\n", path);
+        exit(1);
+    }
+    while ((c = getc(fp)) != EOF)
+        buf_put(&b, c);
+    fclose(fp);
+
+    *len = b.len;
+    return b.data;
+}
+
+static int bystart(const void *a, const void *b)
+{
+    const region_t *x = a, *y = b;
+
+    return x->start - y->start;
+}
+
+/* Words that may hold code: the image and whatever boot() put in memory,
+ * short of the device page */
+static int loaded(VM *vm, uint16_t a)
+{
+    if (a >= DEVPAGE)
+        return 0;
+    if (a >= image_start && a < image_end)
+        return 1;
+    return peek(vm, a) != 0;
+}
+
+static void reach(VM *vm, uint16_t a)
+{
+    if (!loaded(vm, a) || (flags[a] & W_SEEN))
+        return;
+    flags[a] |= W_SEEN;
+    worklist[nwork++] = a;
+}
+
+/* Whether a word reads as an instruction. Zeros, characters and small
+ * numbers decode as BR without a condition, which no code needs. */
+static int decodes(uint16_t instr)
+{
+    switch (instr >> 12)
+    {
+    case BR:
+        return ((instr >> 9) & 0x7) != 0;
+    case JMP:
+        return !(instr & 0xe3f);
+    case NOT:
+        return (instr & 0x3f) == 0x3f;
+    case RES:
+        return 0;
+    case TRAP:
+        return !(instr & 0xf00);
+    }
+    return 1;
+}
+
+/* Follow control flow from the queued words, as lc3c does */
+void walk(VM *vm)
+{
+    uint16_t a, instr, next;
+
+    while (nwork)
+    {
+        a = worklist[--nwork];
+        instr = peek(vm, a);
+        next = a + 1;
+        if (!decodes(instr))
+            continue;
+        flags[a] |= W_CODE;
+
+        switch (instr >> 12)
+        {
+        case BR:
+            if ((instr >> 9) & 0x7)
+                reach(vm, next + sext(instr & 0x1ff, 9));
+            if (((instr >> 9) & 0x7) != 0x7)
+                reach(vm, next);
+            break;
+        case JSR:
+            if ((instr >> 11) & 0x1)
+                reach(vm, next + sext(instr & 0x7ff, 11));
+            reach(vm, next);
+            break;
+        case TRAP:
+            if ((instr & 0xff) != HALT)
+                reach(vm, next);
+            break;
+        case JMP:
+        case RTI:
+            break;
+        default:
+            reach(vm, next);
+        }
+    }
+}
+
+/* Mark the words code reaches with PC-relative loads, stores and LEA */
+void mark_data(VM *vm)
+{
+    unsigned a;
+    uint16_t instr;
+
+    for (a = 0; a < 0x10000; a++)
+    {
+        if (!(flags[a] & W_CODE))
+            continue;
+        instr = peek(vm, a);
+        switch (instr >> 12)
+        {
+        case LD:
+        case LDI:
+        case LEA:
+        case ST:
+        case STI:
+            flags[(uint16_t)(a + 1 + sext(instr & 0x1ff, 9))] |= W_DATA;
+        }
+    }
+}
+
+/* Whether a label the walk missed names code, such as a routine called
+ * only through JSRR: not data, and not a word that fails to read as an
+ * instruction */
+int code_label(VM *vm, uint16_t a)
+{
+    uint16_t instr = peek(vm, a);
+
+    if (!loaded(vm, a) || (flags[a] & (W_SEEN | W_DATA)))
+        return 0;
+    return instr >> 12 != RTI && decodes(instr);
+}
+
+/* Whether the word at a counts towards coverage: it ran, or the walk
+ * reached it as an instruction and code does not use it as data */
+static int counted(const cov_t *cov, uint16_t a)
+{
+    if (COV_GET(cov->addr, a))
+        return 1;
+    return (flags[a] & W_CODE) && !(flags[a] & W_DATA);
+}
+
+/* Conditional branches at addr, and how many have gone both ways */
+void branches(VM *vm, const cov_t *cov, uint16_t addr, int *nbr, int *nboth,
+              int verbose)
+{
+    uint16_t instr = peek(vm, addr), target;
+    int cond = (instr >> 9) & 0x7, taken, fell;
+    char text[32];
+
+    if (instr >> 12 != BR || cond == 0 || cond == 0x7 ||
+        !COV_GET(cov->addr, addr))
+        return;
+
+    target = addr + 1 + sext(instr & 0x1ff, 9);
+    taken = COV_GET(cov->edge, COV_EDGE(addr, target));
+    fell = COV_GET(cov->edge, COV_EDGE(addr, addr + 1));
+    (*nbr)++;
+    if ((taken && fell) || target == addr + 1)
+    {
+        (*nboth)++;
+        return;
+    }
+    if (verbose)
+    {
+        disasm(text, sizeof(text), addr, instr);
+        printf("    x%04x  %-24s %s\n", addr, text,
+               taken ? "always taken" : "never taken");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char path[256], text[32], *dot;
+    const char *sympath = NULL;
+    const symdef_t *sym;
+    int i, j, nr = 0, verbose = 0, nbr, nboth, vbr, vboth, tbr = 0, tboth = 0;
+    uint32_t a, end, nexec, nwords, texec = 0, twords = 0;
+    symmap_t syms = {0};
+    region_t *rg;
+    uint8_t *obj;
+    size_t len;
+    cov_t *cov;
+    VM *vm;
+    int origin;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0)
+            verbose = 1;
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            sympath = argv[++i];
+        else
+            usage();
+    }
+    if (argc - i < 2)
+        usage();
+
+    vm = malloc(sizeof(*vm));
+    cov = calloc(1, sizeof(*cov));
+    if (!vm || !cov)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    /* The image and boot ROM give the code the bitmaps are checked against */
+    boot(vm);
+    obj = slurp(argv[i], &len);
+    origin = obj_load(vm, obj, len);
+    if (origin == -1)
+    {
+        fprintf(stderr, "'%s' is not an image\n", argv[i]);
+        exit(1);
+    }
+    end = origin + len / 2 - 1;
+    image_start = origin;
+    image_end = end;
+
+    /* The symbol map sits next to the image by default */
+    if (!sympath)
+    {
+        snprintf(path, sizeof(path), "%s", argv[i]);
+        dot = strrchr(path, '.');
+        if (dot && strlen(dot) == 4)
+            strcpy(dot, ".sym");
+        sympath = path;
+    }
+    symmap_load(&syms, sympath);
+
+    /* Runs are merged by setting every bit any of them set */
+    for (i++; i < argc; i++)
+        if (cov_load(cov, argv[i]) == -1)
+        {
+            fprintf(stderr, "'%s' is not a coverage file\n", argv[i]);
+            exit(1);
+        }
+
+    /* Code is what the origin, the trap routines, whatever ran and the
+     * labels on code reach */
+    reach(vm, origin);
+    for (a = GETC; a <= HALT; a++)
+        reach(vm, peek(vm, a));
+    for (a = 0; a < DEVPAGE; a++)
+        if (COV_GET(cov->addr, a))
+            reach(vm, a);
+    walk(vm);
+    mark_data(vm);
+    for (j = 0; j < syms.n; j++)
+        if (code_label(vm, syms.sym[j].addr))
+            reach(vm, syms.sym[j].addr);
+    walk(vm);
+
+    rg = calloc(syms.n + 8, sizeof(*rg));
+    if (!rg)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (j = 0; j < (int)(sizeof(trapname) / sizeof(trapname[0])); j++)
+    {
+        snprintf(rg[nr].name, SYMNAME, "%s", trapname[j]);
+        rg[nr++].start = peek(vm, GETC + j);
+    }
+    for (j = 0; j < syms.n; j++)
+        if (syms.sym[j].addr >= origin && syms.sym[j].addr < end)
+        {
+            rg[nr].start = syms.sym[j].addr;
+            memcpy(rg[nr++].name, syms.sym[j].name, SYMNAME);
+        }
+    sym = symmap_near(&syms, origin);
+    if (!sym || sym->addr != origin)
+    {
+        snprintf(rg[nr].name, SYMNAME, "x%04x", origin);
+        rg[nr++].start = origin;
+    }
+    qsort(rg, nr, sizeof(*rg), bystart);
+
+    /* Each region runs to the next, or the end of the image or memory,
+     * less any words at its end that are not code */
+    for (j = 0; j < nr; j++)
+    {
+        rg[j].end = j + 1 < nr ? rg[j + 1].start : DEVPAGE;
+        if (rg[j].start < end && rg[j].end > end)
+            rg[j].end = end;
+        while (rg[j].end > rg[j].start && !counted(cov, rg[j].end - 1))
+            rg[j].end--;
+    }
+
+    printf("%-20s %5s %15s %7s %11s\n", "region", "addr", "executed", "",
+           "branches");
+    for (j = 0; j < nr; j++)
+    {
+        if (rg[j].end == rg[j].start)
+            continue;
+
+        nexec = nwords = nbr = nboth = 0;
+        for (a = rg[j].start; a < rg[j].end; a++)
+        {
+            if (!counted(cov, a))
+                continue;
+            nwords++;
+            nexec += COV_GET(cov->addr, a);
+            branches(vm, cov, a, &nbr, &nboth, 0);
+        }
+
+        printf("%-20s x%04x %7u/%-7u %6.1f%%", rg[j].name, rg[j].start,
+               nexec, nwords, 100.0 * nexec / nwords);
+        if (nbr)
+            printf(" %5d/%-5d\n", nboth, nbr);
+        else
+            printf(" %5s\n", "-");
+
+        /* What was never run, and branches that only went one way */
+        for (a = rg[j].start; verbose && a < rg[j].end; a++)
+        {
+            if (COV_GET(cov->addr, a))
+            {
+                branches(vm, cov, a, &vbr, &vboth, 1);
+                continue;
+            }
+            if (!counted(cov, a))
+                continue;
+            disasm(text, sizeof(text), a, peek(vm, a));
+            printf("    x%04x  %-24s never run\n", a, text);
+        }
+
+        texec += nexec;
+        twords += nwords;
+        tbr += nbr;
+        tboth += nboth;
+    }
+    printf("%-20s %5s %7u/%-7u %6.1f%% %5d/%-5d\n", "total", "", texec,
+           twords, twords ? 100.0 * texec / twords : 0.0, tboth, tbr);
+
+    free(rg);
+    free(obj);
+    free(cov);
+    symmap_free(&syms);
+    poweroff(vm);
+    free(vm);
+
+    return 0;
+}
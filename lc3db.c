@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "disasm.h"
+#include "symmap.h"
+
+VM vm;
+symmap_t syms;
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: lc3db [-i input] [-s symbols] <file>\n");
+    exit(1);
+}
+
+/* Ctrl-C stops a running program at the next instruction */
+void onint(int sig)
+{
+    (void)sig;
+    vm.stop = VM_STOP;
+    vm.stop_at = 0;
+}
+
+/* Parse a label, xHEX or #DEC location. Returns -1 if invalid. */
+int location(const char *s)
+{
+    char *end;
+    long n;
+
+    if (s[0] == 'x' || s[0] == '#')
+    {
+        n = strtol(s + 1, &end, s[0] == 'x' ? 16 : 10);
+        if (*end == '\0' && end != s + 1)
+            return n & 0xffff;
+    }
+    return symmap_addr(&syms, s);
+}
+
+/* Print addr as xADDR <label+off> */
+void where(uint16_t addr)
+{
+    const symdef_t *sym = symmap_near(&syms, addr);
+
+    printf("x%04x", addr);
+    if (sym && sym->addr == addr)
+        printf(" <%s>", sym->name);
+    else if (sym)
+        printf(" <%s+%d>", sym->name, addr - sym->addr);
+}
+
+void show(uint16_t addr)
+{
+    char text[32];
+    uint16_t instr = peek(&vm, addr);
+
+    disasm(text, sizeof(text), addr, instr);
+    where(addr);
+    printf(":  %04x  %s\n", instr, text);
+}
+
+void regs(void)
+{
+    int i;
+    uint16_t psr = psr_read(&vm);
+
+    for (i = R0; i <= R7; i++)
+        printf("R%d x%04x%s", i, vm.reg[i], i % 4 == 3 ? "\n" : "  ");
+    printf("PC x%04x  PSR x%04x %s PL%d %c%c%c  icount %llu\n", vm.reg[PC],
+           psr, psr & PSR_USER ? "user" : "super", (psr & PSR_PL) >> 8,
+           psr & 0x4 ? 'n' : '-', psr & 0x2 ? 'z' : '-',
+           psr & 0x1 ? 'p' : '-', (unsigned long long)vm.icount);
+}
+
+/* Print anything the program wrote since the last stop */
+void drain(void)
+{
+    fwrite(vm.outbuf.data, 1, vm.outbuf.len, stdout);
+    vm.outbuf.len = 0;
+}
+
+/* Report why run() returned. Returns 0 once the program is finished. */
+int report(int status)
+{
+    drain();
+
+    switch (status)
+    {
+    case VM_HALT:
+        printf("program halted\n");
+        return 0;
+    case VM_ILLEGAL:
+        printf("illegal opcode exception\n");
+        return 0;
+    case VM_PRIV:
+        printf("privilege mode exception\n");
+        return 0;
+    case VM_BREAK:
+        printf("breakpoint ");
+        break;
+    case VM_WATCH:
+        printf("watchpoint x%04x ", vm.watch_addr);
+        break;
+    case VM_STOP:
+        printf("interrupted ");
+        break;
+    }
+    show(vm.reg[PC]);
+    return 1;
+}
+
+void help(void)
+{
+    printf("b LOC       set breakpoint\n"
+           "d LOC       delete breakpoint\n"
+           "w LOC       watch address\n"
+           "u LOC       unwatch address\n"
+           "s [N]       step N instructions\n"
+           "c           continue\n"
+           "r           show registers\n"
+           "x LOC [N]   examine N words\n"
+           "q           quit\n"
+           "LOC is a label, xHEX or #DEC\n");
+}
+
+int main(int argc, char **argv)
+{
+    char line[256], cmd[16], arg[64], path[256], *dot;
+    const char *sympath = NULL, *inpath = NULL;
+    int i, n, loc, status, live = 1;
+    struct sigaction sa;
+    buf_t input = {0};
+    FILE *fp;
+
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-i") == 0)
+            inpath = argv[++i];
+        else if (strcmp(argv[i], "-s") == 0)
+            sympath = argv[++i];
+        else
+            usage();
+    }
+    if (i != argc - 1)
+        usage();
+
+    /* The symbol map sits next to the image by default */
+    if (!sympath)
+    {
+        snprintf(path, sizeof(path), "%s", argv[i]);
+        dot = strrchr(path, '.');
+        if (dot && strlen(dot) == 4)
+            strcpy(dot, ".sym");
+        sympath = path;
+    }
+    if (symmap_load(&syms, sympath) == 0)
+        printf("%d symbols from %s\n", syms.n, sympath);
+
+    if (inpath)
+    {
+        fp = fopen(inpath, "rb");
+        if (!fp)
+        {
+            fprintf(stderr, "unable to open '%s'\n", inpath);
+            exit(1);
+        }
+        while ((n = getc(fp)) != EOF)
+            buf_put(&input, n);
+        fclose(fp);
+    }
+
+    boot(&vm);
+    vm.reg[PC] = read_obj(&vm, argv[i]);
+    headless(&vm, input.data, input.len);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onint;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+
+    show(vm.reg[PC]);
+
+    while (live != -1 && (printf("(lc3db) "), fflush(stdout),
+                          fgets(line, sizeof(line), stdin)))
+    {
+        arg[0] = '\0';
+        if (sscanf(line, "%15s %63s %d", cmd, arg, &n) < 1)
+            continue;
+
+        loc = arg[0] ? location(arg) : -1;
+
+        switch (cmd[0])
+        {
+        case 'b':
+        case 'd':
+        case 'w':
+        case 'u':
+            if (loc == -1)
+            {
+                printf("bad location '%s'\n", arg);
+                break;
+            }
+            if (cmd[0] == 'b')
+                status = brk_set(&vm, loc);
+            else if (cmd[0] == 'd')
+                status = brk_clear(&vm, loc);
+            else if (cmd[0] == 'w')
+                status = watch_set(&vm, loc);
+            else
+                status = watch_clear(&vm, loc);
+            if (status == -1)
+                printf("failed\n");
+            break;
+        case 's':
+            n = arg[0] ? atoi(arg) : 1;
+            status = VM_BUDGET;
+            while (live && n-- > 0 && status == VM_BUDGET)
+                status = step(&vm);
+            if (!live)
+                printf("program is not running\n");
+            else if (status == VM_BUDGET)
+            {
+                drain();
+                show(vm.reg[PC]);
+            }
+            else
+                live = report(status);
+            break;
+        case 'c':
+            if (!live)
+            {
+                printf("program is not running\n");
+                break;
+            }
+            /* Leave the breakpoint we are sitting on, then run freely */
+            status = step(&vm);
+            if (status == VM_BUDGET)
+                status = run(&vm, 0);
+            live = report(status);
+            break;
+        case 'r':
+            regs();
+            break;
+        case 'x':
+            if (loc == -1)
+            {
+                printf("bad location '%s'\n", arg);
+                break;
+            }
+            if (sscanf(line, "%15s %63s %d", cmd, arg, &n) < 3)
+                n = 1;
+            for (i = 0; i < n; i++)
+                show(loc + i);
+            break;
+        case 'q':
+            live = -1;
+            break;
+        default:
+            help();
+        }
+    }
+
+    poweroff(&vm);
+    free(input.data);
+    symmap_free(&syms);
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "symmap.h"
+#include "timing.h"
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: lc3time [-m model] [-s symbols] [-i input] "
+                    "[-b budget] <file>\n");
+    exit(1);
+}
+
+/* Hit rate as a percentage, or a dash if there were no accesses */
+void rate(uint64_t hit, uint64_t miss)
+{
+    if (hit + miss)
+        fprintf(stderr, " %6.1f%%", 100.0 * hit / (hit + miss));
+    else
+        fprintf(stderr, " %7s", "-");
+}
+
+static int bycycles(const void *a, const void *b)
+{
+    const tstat_t *x = a, *y = b;
+
+    return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : 0;
+}
+
+/* Totals, then each routine from the most expensive down */
+void report(timing_t *t, const symmap_t *syms)
+{
+    const symdef_t *sym;
+    char name[SYMNAME];
+    tstat_t *s;
+    int i;
+
+    fprintf(stderr, "\n%-20s %8s %12s %12s %6s %7s %7s %7s\n", "routine",
+            "calls", "instrs", "cycles", "CPI", "cyc%", "I-hit", "D-hit");
+
+    qsort(t->rt, t->nrt, sizeof(t->rt[0]), bycycles);
+    for (i = -1; i < t->nrt; i++)
+    {
+        s = i == -1 ? &t->total : &t->rt[i];
+        sym = symmap_near(syms, s->entry);
+        if (i == -1)
+            strcpy(name, "total");
+        else if (sym && sym->addr == s->entry)
+            snprintf(name, sizeof(name), "%s", sym->name);
+        else
+            snprintf(name, sizeof(name), "x%04x", s->entry);
+
+        fprintf(stderr, "%-20s %8llu %12llu %12llu %6.2f %6.1f%%", name,
+                (unsigned long long)(i == -1 ? 1 : s->calls),
+                (unsigned long long)s->instrs,
+                (unsigned long long)s->cycles,
+                s->instrs ? (double)s->cycles / s->instrs : 0.0,
+                t->total.cycles ? 100.0 * s->cycles / t->total.cycles : 0.0);
+        rate(s->ihit, s->imiss);
+        rate(s->dhit, s->dmiss);
+        fprintf(stderr, "\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char path[256], *dot;
+    const char *model = NULL, *sympath = NULL, *inpath = NULL;
+    uint64_t budget = 0;
+    symmap_t syms = {0};
+    timing_t t;
+    buf_t input = {0};
+    FILE *fp;
+    VM *vm;
+    int i, c, status;
+
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-m") == 0)
+            model = argv[++i];
+        else if (strcmp(argv[i], "-s") == 0)
+            sympath = argv[++i];
+        else if (strcmp(argv[i], "-i") == 0)
+            inpath = argv[++i];
+        else if (strcmp(argv[i], "-b") == 0)
+            budget = strtoull(argv[++i], NULL, 0);
+        else
+            usage();
+    }
+    if (i != argc - 1)
+        usage();
+
+    if (timing_init(&t, model) == -1)
+        exit(1);
+
+    /* The symbol map sits next to the image by default */
+    if (!sympath)
+    {
+        snprintf(path, sizeof(path), "%s", argv[i]);
+        dot = strrchr(path, '.');
+        if (dot && strlen(dot) == 4)
+            strcpy(dot, ".sym");
+        sympath = path;
+    }
+    symmap_load(&syms, sympath);
+
+    vm = malloc(sizeof(*vm));
+    if (!vm)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    boot(vm);
+    vm->reg[PC] = read_obj(vm, argv[i]);
+
+    /* Scripted input runs the machine headless */
+    if (inpath)
+    {
+        fp = fopen(inpath, "rb");
+        if (!fp)
+        {
+            fprintf(stderr, "unable to open '%s'\n", inpath);
+            exit(1);
+        }
+        while ((c = getc(fp)) != EOF)
+            buf_put(&input, c);
+        fclose(fp);
+        headless(vm, input.data, input.len);
+    }
+
+    status = timing_run(vm, &t, budget);
+
+    if (vm->headless)
+        fwrite(vm->outbuf.data, 1, vm->outbuf.len, stdout);
+    fflush(stdout);
+
+    report(&t, &syms);
+    if (status == VM_BUDGET)
+        fprintf(stderr, "instruction budget exhausted\n");
+    else if (status != VM_HALT)
+        fprintf(stderr, "stopped by an exception\n");
+
+    poweroff(vm);
+    free(vm);
+    free(input.data);
+    timing_free(&t);
+    symmap_free(&syms);
+
+    return status == VM_HALT ? 0 : status == VM_BUDGET ? 2 : 1;
+}
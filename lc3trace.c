@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disasm.h"
+#include "trace.h"
+
+int main(int argc, char **argv)
+{
+    thdr_t hdr;
+    trec_t rec;
+    uint64_t seq;
+    uint32_t i;
+    char text[32];
+    FILE *fp;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: lc3trace <file>\n");
+        exit(1);
+    }
+
+    fp = fopen(argv[1], "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "unable to open '%s'\n", argv[1]);
+        exit(1);
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0)
+    {
+        fprintf(stderr, "'%s' is not a trace\n", argv[1]);
+        exit(1);
+    }
+
+    seq = hdr.total - hdr.count;
+    for (i = 0; i < hdr.count; i++, seq++)
+    {
+        if (fread(&rec, sizeof(rec), 1, fp) != 1)
+        {
+            fprintf(stderr, "trace truncated after %u records\n", i);
+            exit(1);
+        }
+        disasm(text, sizeof(text), rec.pc, rec.instr);
+        printf("%10llu  x%04x  %04x  %-20s  val=x%04x addr=x%04x\n",
+               (unsigned long long)seq, rec.pc, rec.instr, text, rec.val,
+               rec.addr);
+    }
+
+    fclose(fp);
+
+    return 0;
+}
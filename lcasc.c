@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "asmd.h"
+#include "swap.h"
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: lcasc [-b] [-s socket] [-o object] <file>\n"
+                    "       lcasc [-b] [-s socket] [-o object] -l library\n");
+    exit(1);
+}
+
+static void put_file(const char *path, const uint8_t *data, size_t len)
+{
+    FILE *fp = fopen(path, "wb");
+
+    if (!fp || fwrite(data, 1, len, fp) != len || fclose(fp) != 0)
+    {
+        fprintf(stderr, "unable to write '%s'\n", path);
+        exit(1);
+    }
+}
+
+/* Assemble a file, or fetch a library, through lcasd. The object and
+ * symbol map are written where lcas would put them, the object big-endian
+ * with -b. */
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    const char *sockpath = ASMD_SOCKET, *objpath = NULL, *lib = NULL;
+    char objbuf[4096], sympath[4096], *dot, *slash;
+    uint8_t *data = NULL;
+    size_t len = 0, cap = 0, objlen;
+    FILE *fp;
+    int i, c, fd, type, order = OBJ_LITTLE;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-b") == 0)
+            order = OBJ_BIG;
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            sockpath = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            objpath = argv[++i];
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            lib = argv[++i];
+        else
+            usage();
+    }
+    if (i != argc - !lib)
+        usage();
+
+    if (lib)
+    {
+        len = strlen(lib);
+        data = malloc(len);
+        if (!data)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        memcpy(data, lib, len);
+    }
+    else
+    {
+        fp = fopen(argv[i], "rb");
+        if (!fp)
+        {
+            fprintf(stderr, "unable to open '%s'\n", argv[i]);
+            exit(1);
+        }
+        while ((c = getc(fp)) != EOF)
+        {
+            if (len == cap)
+            {
+                cap = cap ? 2 * cap : 4096;
+                data = realloc(data, cap);
+                if (!data)
+                {
+                    fprintf(stderr, "out of memory\n");
+                    exit(1);
+                }
+            }
+            data[len++] = c;
+        }
+        fclose(fp);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sockpath);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        fprintf(stderr, "unable to reach lcasd at '%s'\n", sockpath);
+        exit(1);
+    }
+
+    if (frame_write(fd, lib ? ASMD_LIB : ASMD_ASM, data, len) == -1 ||
+        (type = frame_read(fd, &data, &len)) == -1)
+    {
+        fprintf(stderr, "lcasd hung up\n");
+        exit(1);
+    }
+    close(fd);
+
+    /* The daemon does not know the file's name; each line it sends back
+     * gets it here */
+    if (type == ASMD_ERR)
+    {
+        for (objlen = 0; objlen < len; objlen = dot - (char *)data + 1)
+        {
+            dot = memchr(data + objlen, '\n', len - objlen);
+            if (!dot)
+                dot = (char *)data + len;
+            fprintf(stderr, "%s:%.*s\n", lib ? lib : argv[i],
+                    (int)(dot - (char *)data - objlen), data + objlen);
+        }
+        exit(1);
+    }
+    if (type != ASMD_OBJ || len < 4 || (objlen = get32(data)) > len - 4)
+    {
+        fprintf(stderr, "bad reply from lcasd\n");
+        exit(1);
+    }
+
+    /* The object goes next to the source, or is named for the library,
+     * and the symbol map goes next to the object */
+    if (!objpath)
+    {
+        snprintf(objbuf, sizeof(objbuf), "%s", lib ? lib : argv[i]);
+        dot = strrchr(objbuf, '.');
+        slash = strrchr(objbuf, '/');
+        if (dot && (!slash || dot > slash))
+            *dot = '\0';
+        strncat(objbuf, ".lc3", sizeof(objbuf) - strlen(objbuf) - 1);
+        objpath = objbuf;
+    }
+    snprintf(sympath, sizeof(sympath), "%s", objpath);
+    dot = strrchr(sympath, '.');
+    slash = strrchr(sympath, '/');
+    if (dot && (!slash || dot > slash))
+        *dot = '\0';
+    strncat(sympath, ".sym", sizeof(sympath) - strlen(sympath) - 1);
+
+    /* lcasd sends objects little-endian */
+    if (order != OBJ_LITTLE)
+        swap16((uint16_t *)(data + 4), objlen / 2);
+    put_file(objpath, data + 4, objlen);
+    put_file(sympath, data + 4 + objlen, len - 4 - objlen);
+    free(data);
+
+    return 0;
+}
@@ -0,0 +1,503 @@
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "asmd.h"
+#include "diag.h"
+#include "emit.h"
+#include "global.h"
+#include "panic.h"
+#include "parse.h"
+#include "preproc.h"
+#include "symbol.h"
+
+/* A reply as it goes out on the wire */
+typedef struct reply_s
+{
+    int type;
+    uint8_t *data;
+    size_t len;
+} reply_t;
+
+/* Recent replies, direct-mapped by a hash of the source they came from */
+#define NSLOT 256
+
+typedef struct slot_s
+{
+    uint32_t hash;
+    char *src;
+    size_t srclen;
+    reply_t r;
+} slot_t;
+
+/* A symbol a library defines */
+typedef struct libsym_s
+{
+    char name[64];
+    int addr;
+} libsym_t;
+
+/* A library assembled at startup, sent by name. The sources sent to be
+ * assembled may refer to its symbols. */
+typedef struct lib_s
+{
+    char name[64];
+    reply_t r;
+    libsym_t *syms;
+    int nsyms;
+} lib_t;
+
+static slot_t cache[NSLOT];
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The assembler keeps its state in globals, so it takes one source at a
+ * time. The workers overlap everything else. */
+static pthread_mutex_t asm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static lib_t *libs;
+static int nlibs;
+
+static const char *sockpath = ASMD_SOCKET;
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: lcasd [-s socket] [-j threads] [-r root] "
+                    "[-l library]...\n");
+    exit(1);
+}
+
+static void *xmalloc(size_t n)
+{
+    void *p = malloc(n ? n : 1);
+
+    if (!p)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* FNV-1a */
+static uint32_t hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    while (len--)
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+static void reply_err(reply_t *r, const char *msg)
+{
+    r->type = ASMD_ERR;
+    r->len = strlen(msg);
+    r->data = xmalloc(r->len);
+    memcpy(r->data, msg, r->len);
+}
+
+static void reply_copy(reply_t *dst, const reply_t *src)
+{
+    dst->type = src->type;
+    dst->len = src->len;
+    dst->data = xmalloc(src->len);
+    memcpy(dst->data, src->data, src->len);
+}
+
+/* The address a library gives name, or -1 if none does */
+static int lib_addr(const char *name)
+{
+    int i, k;
+
+    for (i = 0; i < nlibs; i++)
+        for (k = 0; k < libs[i].nsyms; k++)
+            if (strcmp(libs[i].syms[k].name, name) == 0)
+                return libs[i].syms[k].addr;
+    return -1;
+}
+
+/* Give the symbols the source uses but does not define their addresses
+ * in the libraries, and patch in the references to them */
+static void link_libs(void)
+{
+    int p, addr;
+
+    for (p = 0; p <= lastsym; p++)
+    {
+        if (symtable[p].defined || symtable[p].macro != -1)
+            continue;
+        if ((addr = lib_addr(symtable[p].lexeme)) == -1)
+            continue;
+        symtable[p].offset = addr;
+        symtable[p].defined = SYM_EXTERN;
+        emit_label(p);
+    }
+}
+
+/* Assemble src into an object reply, or an error reply with the
+ * assembler's diagnostics, one per line. Return 1 if the reply depends on
+ * nothing but src and the libraries. Relative includes are found from
+ * lcasd's directory, and must be within the include root. */
+static int assemble(const char *src, size_t len, reply_t *r)
+{
+    jmp_buf env;
+    char *sym;
+    size_t symlen, objlen;
+    FILE *fp;
+    int pure;
+
+    if (!len)
+    {
+        reply_err(r, "empty source");
+        return 1;
+    }
+
+    pthread_mutex_lock(&asm_lock);
+    infile = fmemopen((void *)src, len, "r");
+    if (!infile)
+    {
+        pthread_mutex_unlock(&asm_lock);
+        reply_err(r, "unable to read source");
+        return 1;
+    }
+    listing = 0;
+
+    panic_jmp = &env;
+    if (!setjmp(env))
+    {
+        emit_begin(NULL);
+        parse();
+        link_libs();
+        emit_end();
+
+        sym = NULL;
+        symlen = 0;
+        fp = open_memstream(&sym, &symlen);
+        if (!fp)
+            panic("out of memory");
+        if (ndiags)
+            diag_report(fp, NULL, 0);
+        else
+            emit_symbols(fp);
+        fclose(fp);
+
+        if (ndiags)
+        {
+            r->type = ASMD_ERR;
+            r->len = symlen;
+            r->data = (uint8_t *)sym;
+        }
+        else
+        {
+            objlen = imagelen * INSTR_WIDTH;
+            r->type = ASMD_OBJ;
+            r->len = 4 + objlen + symlen;
+            r->data = xmalloc(r->len);
+            put32(r->data, objlen);
+            memcpy(r->data + 4, image, objlen);
+            /* Objects go out little-endian; lcasc turns them around */
+            if (host_order() != OBJ_LITTLE)
+                swap16((uint16_t *)(r->data + 4), imagelen);
+            memcpy(r->data + 4 + objlen, sym, symlen);
+            free(sym);
+        }
+    }
+    else
+        reply_err(r, panic_msg);
+    panic_jmp = NULL;
+    pure = !included;
+
+    fclose(infile);
+    infile = NULL;
+    pthread_mutex_unlock(&asm_lock);
+    return pure;
+}
+
+/* Copy out the cached reply for src, if there is one */
+static int cache_get(const char *src, size_t len, uint32_t h, reply_t *r)
+{
+    slot_t *s = &cache[h % NSLOT];
+    int hit;
+
+    pthread_mutex_lock(&cache_lock);
+    hit = s->src && s->hash == h && s->srclen == len &&
+          memcmp(s->src, src, len) == 0;
+    if (hit)
+        reply_copy(r, &s->r);
+    pthread_mutex_unlock(&cache_lock);
+    return hit;
+}
+
+static void cache_put(const char *src, size_t len, uint32_t h,
+                      const reply_t *r)
+{
+    slot_t *s = &cache[h % NSLOT];
+    char *copy = xmalloc(len);
+    reply_t rc;
+
+    memcpy(copy, src, len);
+    reply_copy(&rc, r);
+
+    pthread_mutex_lock(&cache_lock);
+    free(s->src);
+    free(s->r.data);
+    s->hash = h;
+    s->src = copy;
+    s->srclen = len;
+    s->r = rc;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* Reply to one request */
+static void serve(int type, const uint8_t *data, size_t len, reply_t *r)
+{
+    const char *src = (const char *)data;
+    uint32_t h;
+    int i;
+
+    switch (type)
+    {
+    case ASMD_ASM:
+        h = hash(src, len);
+        if (cache_get(src, len, h, r))
+            return;
+        /* Files it includes may change, so such a source is assembled
+         * afresh every time */
+        if (assemble(src, len, r))
+            cache_put(src, len, h, r);
+        return;
+    case ASMD_LIB:
+        for (i = 0; i < nlibs; i++)
+            if (strcmp(libs[i].name, src) == 0)
+            {
+                reply_copy(r, &libs[i].r);
+                return;
+            }
+        reply_err(r, "no such library");
+        return;
+    default:
+        reply_err(r, "unknown request");
+    }
+}
+
+/* Take connections off the listening socket and answer their requests
+ * until they hang up. Every worker accepts for itself. */
+static void *worker(void *arg)
+{
+    int lfd = *(int *)arg, fd, type;
+    uint8_t *data = NULL;
+    size_t len;
+    reply_t r;
+
+    for (;;)
+    {
+        fd = accept(lfd, NULL, NULL);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            exit(1);
+        }
+
+        while ((type = frame_read(fd, &data, &len)) != -1)
+        {
+            serve(type, data, len, &r);
+            type = frame_write(fd, r.type, r.data, r.len);
+            free(r.data);
+            if (type == -1)
+                break;
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Read the symbols back out of a library's reply */
+static void lib_syms(lib_t *l)
+{
+    const char *p = (const char *)l->r.data + 4 + get32(l->r.data);
+    const char *end = (const char *)l->r.data + l->r.len, *nl;
+    char line[128];
+    unsigned addr;
+    libsym_t *s;
+
+    for (; p < end; p = nl + 1)
+    {
+        nl = memchr(p, '\n', end - p);
+        if (!nl)
+            nl = end;
+        snprintf(line, sizeof(line), "%.*s", (int)(nl - p), p);
+        if (l->nsyms % 64 == 0)
+        {
+            s = realloc(l->syms, (l->nsyms + 64) * sizeof(*s));
+            if (!s)
+            {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            l->syms = s;
+        }
+        s = &l->syms[l->nsyms];
+        if (sscanf(line, "%63s x%x", s->name, &addr) == 2)
+        {
+            s->addr = addr;
+            l->nsyms++;
+        }
+    }
+}
+
+/* Assemble a library once, up front; it is then sent by the name of its
+ * file without directory or extension */
+static void lib_load(const char *path)
+{
+    const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    char *src = NULL, *dot;
+    size_t len = 0, cap = 0;
+    lib_t *l;
+    FILE *fp = fopen(path, "rb");
+    int c, pure;
+
+    if (!fp)
+    {
+        fprintf(stderr, "unable to open '%s'\n", path);
+        exit(1);
+    }
+    while ((c = getc(fp)) != EOF)
+    {
+        if (len == cap)
+        {
+            cap = cap ? 2 * cap : 4096;
+            src = realloc(src, cap);
+            if (!src)
+            {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+        }
+        src[len++] = c;
+    }
+    fclose(fp);
+
+    l = realloc(libs, (nlibs + 1) * sizeof(*libs));
+    if (!l)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    libs = l;
+    l = &libs[nlibs++];
+    l->syms = NULL;
+    l->nsyms = 0;
+    snprintf(l->name, sizeof(l->name), "%s", base);
+    if ((dot = strrchr(l->name, '.')))
+        *dot = '\0';
+
+    /* What it includes is found next to it */
+    srcpath = path;
+    pure = assemble(src, len, &l->r);
+    srcpath = NULL;
+    if (l->r.type == ASMD_ERR)
+    {
+        fprintf(stderr, "%s:\n%.*s\n", path, (int)l->r.len, l->r.data);
+        exit(1);
+    }
+    lib_syms(l);
+
+    /* The same source sent as a request is answered from the cache */
+    if (pure)
+        cache_put(src, len, hash(src, len), &l->r);
+    free(src);
+}
+
+static void ondeath(int sig)
+{
+    unlink(sockpath);
+    _exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    pthread_t tid;
+    const char *root = ".";
+    mode_t mask;
+    int i, lfd, nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            sockpath = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            nthreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            root = argv[++i];
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            lib_load(argv[++i]);
+        else
+            usage();
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+
+    /* Libraries include what they like; clients only what is under the
+     * root, the working directory unless -r says otherwise */
+    if (!(inclroot = realpath(root, NULL)))
+    {
+        fprintf(stderr, "unable to find '%s'\n", root);
+        exit(1);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(sockpath) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "socket path too long\n");
+        exit(1);
+    }
+    strcpy(addr.sun_path, sockpath);
+
+    /* A socket left by an earlier daemon is replaced */
+    /* Only its owner may connect */
+    unlink(sockpath);
+    mask = umask(077);
+    lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (lfd == -1 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(lfd, 64) == -1)
+    {
+        fprintf(stderr, "unable to listen on '%s'\n", sockpath);
+        exit(1);
+    }
+    umask(mask);
+
+    /* Clients that hang up mid-reply must not take the daemon down */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPIPE, &sa, NULL);
+    sa.sa_handler = ondeath;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    for (i = 1; i < nthreads; i++)
+        if (pthread_create(&tid, NULL, worker, &lfd) != 0)
+        {
+            fprintf(stderr, "unable to start worker\n");
+            exit(1);
+        }
+    worker(&lfd);
+
+    return 0;
+}
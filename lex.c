@@ -1,20 +1,90 @@
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "diag.h"
 #include "directive.h"
 #include "global.h"
+#include "lex.h"
 #include "lexeme.h"
 #include "op.h"
 #include "panic.h"
 #include "symbol.h"
 #include "token.h"
 
+/* Longest label or directive */
 #define BSIZE 20
 
+FILE *infile;
+const char *srcpath;
+
+/* Which file infile is, as numbered by diag_file() */
+int srcfile;
+
 int lineno = 1;
 int tokenval = 0;
 
-char lexbuf[BSIZE];
+/* Column of the last character read, and where the last token started */
+int colno;
+static int lastcol;
+pos_t tokpos;
+
+/* Set while a bad line is skipped; its errors are not reported */
+int quiet;
+
+char lexbuf[STRMAX];
+
+/* The last string literal. Strings are assembled on the line they appear
+ * on, so they are not kept in the lexeme table. */
+char strval[STRMAX];
+
+/* Read a character, keeping track of the line and column */
+static int getch(void)
+{
+    int c = fgetc(infile);
+
+    if (c == '\n')
+    {
+        ++lineno;
+        lastcol = colno;
+        colno = 0;
+    }
+    else if (c != EOF)
+        ++colno;
+    return c;
+}
+
+static void ungetch(int c)
+{
+    if (c == EOF)
+        return;
+    ungetc(c, infile);
+    if (c == '\n')
+    {
+        --lineno;
+        colno = lastcol;
+    }
+    else
+        --colno;
+}
+
+/* Report a malformed token where it started and return ERROR in its place */
+static int lex_error(const char *fmt, ...)
+{
+    char msg[128];
+    va_list ap;
+
+    if (!quiet)
+    {
+        va_start(ap, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, ap);
+        va_end(ap);
+        diag(tokpos, "%s", msg);
+    }
+    tokenval = NONE;
+    return ERROR;
+}
 
 /* Return 1 if c is a valid hexadecimal digit, 0 otherwise. */
 int ishex(int c)
@@ -45,7 +115,7 @@ int hex2dec(int c)
         return 15;
     }
 
-    panic("unexpected token '%c', lineno %d", c, lineno);
+    panic("unexpected token '%c'", c);
 
     return -1;
 }
@@ -55,7 +125,7 @@ int escaped(char c)
 {
     if (c == '\\')
     {
-        c = fgetc(infile);
+        c = getch();
         switch (c)
         {
         case 'n':
@@ -79,66 +149,76 @@ int lexan(void)
     int c;
     while (1)
     {
-        c = fgetc(infile);
+        c = getch();
+        tokpos.file = srcfile;
+        tokpos.line = lineno;
+        tokpos.col = colno;
 
         if (isspace(c))
-        {
-            if (c == '\n')
-                ++lineno;
             continue;
-        }
         else if (c == ';')
         {
             while (c != EOF && c != '\n')
-                c = fgetc(infile);
-            if (c != EOF)
-                ungetc(c, infile);
+                c = getch();
+            ungetch(c);
             continue;
         }
         else if (c == '.')
         {
             int p, b = 0;
 
-            c = fgetc(infile);
+            c = getch();
 
             if (!isalpha(c))
-                panic("invalid directive, line %d", lineno);
+            {
+                ungetch(c);
+                return lex_error("invalid directive");
+            }
 
             while (isalpha(c))
             {
                 lexbuf[b++] = c;
                 if (b >= BSIZE)
-                    panic("directive too long, line %d", lineno);
-                c = fgetc(infile);
+                    return lex_error("directive too long");
+                c = getch();
             }
             lexbuf[b] = '\0';
 
-            if (c != EOF)
-                ungetc(c, infile);
+            ungetch(c);
 
             p = lookup_directive(lexbuf);
             if (p == -1)
-                panic("invalid directive '%s', line %d", lexbuf, lineno);
+                return lex_error("invalid directive '.%s'", lexbuf);
 
             tokenval = p;
             return DIRECTIVE;
         }
-        else if (c == '#')
+        else if (c == '#' || isdigit(c))
         {
             int neg = 0;
             int n = 0;
 
-            c = fgetc(infile);
-
-            if (c != '-' && !isdigit(c))
-                panic("unexpected token '%c', line %d", lineno);
-
-            if (c == '-')
+            /* A decimal number may have a '#' before it, which may also
+             * begin an expression, as in #SIZE*2 */
+            if (c == '#')
             {
-                neg = 1;
-                c = fgetc(infile);
-                if (!isdigit(c))
-                    panic("unexpected token '-', line %d", lineno);
+                c = getch();
+                if (c == '-')
+                {
+                    c = getch();
+                    if (!isdigit(c))
+                    {
+                        ungetch(c);
+                        tokenval = NONE;
+                        return '-';
+                    }
+                    neg = 1;
+                }
+                else if (!isdigit(c))
+                {
+                    ungetch(c);
+                    continue;
+                }
             }
 
             while (isdigit(c))
@@ -147,11 +227,10 @@ int lexan(void)
                 if ((word)tokenval < n) /* overflow */
                     break;
                 n = tokenval;
-                c = fgetc(infile);
+                c = getch();
             }
 
-            if (c != EOF)
-                ungetc(c, infile);
+            ungetch(c);
 
             if (neg)
                 tokenval = -tokenval;
@@ -162,10 +241,13 @@ int lexan(void)
         {
             int n = 0;
 
-            c = fgetc(infile);
+            c = getch();
 
             if (!ishex(c))
-                panic("unexpected token '%c', line %d", lineno);
+            {
+                ungetch(c);
+                return lex_error("malformed hex number");
+            }
 
             while (ishex(c))
             {
@@ -173,11 +255,10 @@ int lexan(void)
                 if ((word)tokenval < n) /* overflow */
                     break;
                 n = tokenval;
-                c = fgetc(infile);
+                c = getch();
             }
 
-            if (c != EOF)
-                ungetc(c, infile);
+            ungetch(c);
 
             return NUMBER;
         }
@@ -187,7 +268,7 @@ int lexan(void)
 
             if (c == 'R')
             {
-                c = fgetc(infile);
+                c = getch();
 
                 if (isdigit(c) && c <= '7')
                 {
@@ -202,13 +283,12 @@ int lexan(void)
             {
                 lexbuf[b++] = c;
                 if (b >= BSIZE)
-                    panic("label too long, line %d", lineno);
-                c = fgetc(infile);
+                    return lex_error("label too long");
+                c = getch();
             }
             lexbuf[b] = '\0';
 
-            if (c != EOF)
-                ungetc(c, infile);
+            ungetch(c);
 
             /* Handle ops */
             p = lookup_op(lexbuf);
@@ -228,21 +308,30 @@ int lexan(void)
         }
         else if (c == '"')
         {
-            int p, b = 0;
-            c = fgetc(infile);
-            while (c != EOF && c != '"')
+            int b = 0;
+            c = getch();
+            /* A string that is too long is read to its end all the same,
+             * so that what follows it is not taken for code. One left
+             * open ends with its line. */
+            while (c != EOF && c != '"' && c != '\n')
             {
-                lexbuf[b++] = escaped(c);
-                c = fgetc(infile);
+                c = escaped(c);
+                if (b < STRMAX)
+                    strval[b] = c;
+                b++;
+                c = getch();
             }
-            lexbuf[b] = '\0';
 
             if (c != '"')
-                panic("unclosed quote, line %d", lineno);
-
-            p = insert_lexeme(lexbuf);
+            {
+                ungetch(c);
+                return lex_error("unclosed quote");
+            }
+            if (b >= STRMAX)
+                return lex_error("string too long");
+            strval[b] = '\0';
 
-            tokenval = p;
+            tokenval = NONE;
             return STRING;
         }
         else if (c == ',')
@@ -252,9 +341,26 @@ int lexan(void)
         }
         else if (c == EOF)
         {
+            tokpos.col = colno + 1; /* just past the last character */
             return DONE;
         }
+        else if (c && strchr("+-*/%&|^~()", c))
+        {
+            tokenval = NONE;
+            return c;
+        }
+        else if (c == '<' || c == '>')
+        {
+            int d = getch();
+
+            if (d == c)
+            {
+                tokenval = NONE;
+                return c == '<' ? SHL : SHR;
+            }
+            ungetch(d);
+        }
 
-        panic("unexpected token '%c', line %d", c, lineno);
+        return lex_error("unexpected character '%c'", c);
     }
 }
@@ -1,8 +1,22 @@
 #ifndef LEX_H
 #define LEX_H
 
-/* Line number */
+#include "diag.h"
+
+/* Line number and column of the last character read */
 extern int lineno;
+extern int colno;
+
+/* Which file infile is, and where the last token started */
+extern int srcfile;
+extern pos_t tokpos;
+
+/* Set to keep lexical errors from being reported */
+extern int quiet;
+
+/* Longest string literal, and the text of the last STRING token */
+#define STRMAX 256
+extern char strval[STRMAX];
 
 int lexan(void);
 
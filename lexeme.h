@@ -2,6 +2,7 @@
 #define LEXEME_H
 
 extern char lextable[];
+extern int lastchar;
 
 int insert_lexeme(char *s);
 
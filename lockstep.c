@@ -0,0 +1,569 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "lockstep.h"
+#include "op.h"
+
+/* Lockstep engine. Clones of one template that run the same program on
+ * different inputs mostly execute the same instructions, so their register
+ * files are kept side by side, one array per register, and each step
+ * decodes one instruction and executes it for every lane that is at that
+ * PC. Lanes at other PCs sit the step out.
+ *
+ * The lanes at the lowest PC go first, which brings lanes back together
+ * after most branches. A lane that sits out too many steps in a row is
+ * split off and finished by the interpreter, as is any lane that enables
+ * interrupts. Devices, RTI and exceptions are handed to the interpreter
+ * one instruction at a time. */
+
+/* Steps a lane may sit out in a row before it runs on alone */
+#define SPLIT_AFTER 512
+
+typedef uint16_t lane_t[LS_LANES];
+
+typedef struct lanes_s
+{
+    lane_t reg[8];
+    lane_t pc;
+    lane_t cc;    /* last value written, as in vm->cc */
+    lane_t left;  /* steps a lane may run before it syncs with its VM */
+    lane_t grant; /* what left was at the last sync */
+    lane_t wait;  /* steps sat out in a row */
+    uint16_t live;
+    uint64_t stop; /* icount at which the budget runs out */
+    VM *vm[LS_LANES];
+    job_t *job[LS_LANES];
+    uint8_t dirty[0x10000 / 8]; /* addresses some lane has written */
+    cov_t *cov;
+} lanes_t;
+
+/* Lane arithmetic. Each helper updates only the lanes set in m. */
+#ifdef __AVX2__
+
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+
+static __m256i v_mask(uint16_t m)
+{
+    const __m256i bit =
+        _mm256_setr_epi16(0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80, 0x100,
+                          0x200, 0x400, 0x800, 0x1000, 0x2000, 0x4000,
+                          (short)0x8000);
+
+    return _mm256_cmpeq_epi16(_mm256_and_si256(_mm256_set1_epi16(m), bit),
+                              bit);
+}
+
+/* One bit per lane that is all ones */
+static uint16_t v_bits(__m256i v)
+{
+    v = _mm256_packs_epi16(v, v);
+    v = _mm256_permute4x64_epi64(v, 0xd8);
+    return _mm256_movemask_epi8(v) & 0xffff;
+}
+
+static void v_put(uint16_t *d, __m256i v, uint16_t m)
+{
+    V_STORE(d, _mm256_blendv_epi8(V_LOAD(d), v, v_mask(m)));
+}
+
+static void v_add(uint16_t *d, const uint16_t *a, const uint16_t *b,
+                  uint16_t m)
+{
+    v_put(d, _mm256_add_epi16(V_LOAD(a), V_LOAD(b)), m);
+}
+
+static void v_addi(uint16_t *d, const uint16_t *a, uint16_t x, uint16_t m)
+{
+    v_put(d, _mm256_add_epi16(V_LOAD(a), _mm256_set1_epi16(x)), m);
+}
+
+static void v_and(uint16_t *d, const uint16_t *a, const uint16_t *b,
+                  uint16_t m)
+{
+    v_put(d, _mm256_and_si256(V_LOAD(a), V_LOAD(b)), m);
+}
+
+static void v_andi(uint16_t *d, const uint16_t *a, uint16_t x, uint16_t m)
+{
+    v_put(d, _mm256_and_si256(V_LOAD(a), _mm256_set1_epi16(x)), m);
+}
+
+static void v_not(uint16_t *d, const uint16_t *a, uint16_t m)
+{
+    v_put(d, _mm256_xor_si256(V_LOAD(a), _mm256_set1_epi16(-1)), m);
+}
+
+static void v_mov(uint16_t *d, const uint16_t *a, uint16_t m)
+{
+    v_put(d, V_LOAD(a), m);
+}
+
+static void v_set(uint16_t *d, uint16_t x, uint16_t m)
+{
+    v_put(d, _mm256_set1_epi16(x), m);
+}
+
+/* Lanes equal to x */
+static uint16_t v_eq(const uint16_t *a, uint16_t x)
+{
+    return v_bits(_mm256_cmpeq_epi16(V_LOAD(a), _mm256_set1_epi16(x)));
+}
+
+/* Lanes whose flags satisfy a BR condition */
+static uint16_t v_flags(const uint16_t *cc, uint16_t cond)
+{
+    __m256i v = V_LOAD(cc), zero = _mm256_setzero_si256();
+    __m256i n = _mm256_cmpgt_epi16(zero, v), z = _mm256_cmpeq_epi16(v, zero);
+    __m256i nzp = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(n, _mm256_set1_epi16(0x4)),
+                        _mm256_and_si256(z, _mm256_set1_epi16(0x2))),
+        _mm256_andnot_si256(_mm256_or_si256(n, z), _mm256_set1_epi16(0x1)));
+
+    nzp = _mm256_and_si256(nzp, _mm256_set1_epi16(cond));
+    return ~v_bits(_mm256_cmpeq_epi16(nzp, zero)) & 0xffff;
+}
+
+/* Lowest value among the lanes in m */
+static uint16_t v_min(const uint16_t *a, uint16_t m)
+{
+    __m256i v = _mm256_or_si256(
+        V_LOAD(a), _mm256_xor_si256(v_mask(m), _mm256_set1_epi16(-1)));
+    __m128i h = _mm_min_epu16(_mm256_castsi256_si128(v),
+                              _mm256_extracti128_si256(v, 1));
+
+    return _mm_extract_epi16(_mm_minpos_epu16(h), 0);
+}
+
+#else
+
+static void v_add(uint16_t *d, const uint16_t *a, const uint16_t *b,
+                  uint16_t m)
+{
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if ((m >> l) & 0x1)
+            d[l] = a[l] + b[l];
+}
+
+static void v_addi(uint16_t *d, const uint16_t *a, uint16_t x, uint16_t m)
+{
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if ((m >> l) & 0x1)
+            d[l] = a[l] + x;
+}
+
+static void v_and(uint16_t *d, const uint16_t *a, const uint16_t *b,
+                  uint16_t m)
+{
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if ((m >> l) & 0x1)
+            d[l] = a[l] & b[l];
+}
+
+static void v_andi(uint16_t *d, const uint16_t *a, uint16_t x, uint16_t m)
+{
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if ((m >> l) & 0x1)
+            d[l] = a[l] & x;
+}
+
+static void v_not(uint16_t *d, const uint16_t *a, uint16_t m)
+{
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if ((m >> l) & 0x1)
+            d[l] = ~a[l];
+}
+
+static void v_mov(uint16_t *d, const uint16_t *a, uint16_t m)
+{
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if ((m >> l) & 0x1)
+            d[l] = a[l];
+}
+
+static void v_set(uint16_t *d, uint16_t x, uint16_t m)
+{
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if ((m >> l) & 0x1)
+            d[l] = x;
+}
+
+static uint16_t v_eq(const uint16_t *a, uint16_t x)
+{
+    uint16_t m = 0;
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        m |= (a[l] == x) << l;
+    return m;
+}
+
+static uint16_t v_flags(const uint16_t *cc, uint16_t cond)
+{
+    uint16_t m = 0;
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        m |= ((CC_NZP(cc[l]) & cond) != 0) << l;
+    return m;
+}
+
+static uint16_t v_min(const uint16_t *a, uint16_t m)
+{
+    uint16_t x = 0xffff;
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if (((m >> l) & 0x1) && a[l] < x)
+            x = a[l];
+    return x;
+}
+
+#endif
+
+/* Sign-extend the low n bits of x */
+#define SEXT(x, n) ((uint16_t)(((x) ^ (1u << ((n)-1))) - (1u << ((n)-1))))
+
+/* Move lane l's state out to its machine, charging it the instructions it
+ * ran in lockstep since the last time */
+static void lane_put(lanes_t *ls, int l)
+{
+    VM *vm = ls->vm[l];
+    uint16_t n = ls->grant[l] - ls->left[l];
+    int r;
+
+    for (r = R0; r <= R7; r++)
+        vm->reg[r] = ls->reg[r][l];
+    vm->reg[PC] = ls->pc[l];
+    vm->cc = ls->cc[l];
+
+    vm->icount += n;
+    ls->job[l]->nlock += n;
+    ls->grant[l] = ls->left[l];
+}
+
+/* Move lane l's state in from its machine and grant it as many steps as
+ * its budget allows. Returns -1 if the state does not fit the lanes: its
+ * flags were set from the PSR to something no register value gives, or it
+ * has interrupts or the performance counters enabled. */
+static int lane_get(lanes_t *ls, int l)
+{
+    VM *vm = ls->vm[l];
+    int r;
+
+    for (r = R0; r <= R7; r++)
+        ls->reg[r][l] = vm->reg[r];
+    ls->pc[l] = vm->reg[PC];
+
+    ls->left[l] = ls->stop - vm->icount < 0xffff ? ls->stop - vm->icount
+                                                 : 0xffff;
+    ls->grant[l] = ls->left[l];
+
+    if (!(vm->cc & CC_RAW))
+        ls->cc[l] = vm->cc;
+    else if ((vm->cc & 0x7) == 0x4)
+        ls->cc[l] = 0x8000;
+    else if ((vm->cc & 0x7) == 0x2)
+        ls->cc[l] = 0;
+    else if ((vm->cc & 0x7) == 0x1)
+        ls->cc[l] = 1;
+    else
+        return -1;
+
+    return vm->ien || vm->pmon ? -1 : 0;
+}
+
+/* Lane l is done and its state is in its machine; hand the results to the
+ * job */
+static void lane_retire(lanes_t *ls, int l, int status)
+{
+    VM *vm = ls->vm[l];
+    job_t *job = ls->job[l];
+
+    job->status = status;
+    job->icount = vm->icount;
+    job->matched = vm->want.pos;
+    job->out = vm->outbuf;
+    memset(&vm->outbuf, 0, sizeof(vm->outbuf));
+    poweroff(vm);
+    ls->live &= ~(1 << l);
+}
+
+/* Finish lane l on the interpreter, from the state in its machine */
+static void lane_finish(lanes_t *ls, int l)
+{
+    VM *vm = ls->vm[l];
+
+    if (vm->icount >= ls->stop)
+        lane_retire(ls, l, VM_BUDGET);
+    else
+        lane_retire(ls, l,
+                    run(vm, ls->stop == UINT64_MAX ? 0 : ls->stop - vm->icount));
+}
+
+/* Note that a lane wrote addr; fetches from it are checked lane by lane */
+static void lane_dirty(lanes_t *ls, uint16_t addr)
+{
+    ls->dirty[addr >> 3] |= 1 << (addr & 0x7);
+}
+
+/* Interpret the instruction at pc for lane l alone */
+static void lane_step(lanes_t *ls, int l, uint16_t pc)
+{
+    VM *vm = ls->vm[l];
+    int status;
+
+    /* Hand back the step the lockstep loop charged */
+    ls->left[l]++;
+    ls->pc[l] = pc;
+    lane_put(ls, l);
+
+    status = run(vm, 1);
+
+    /* An exception pushes the PSR and PC */
+    lane_dirty(ls, vm->reg[R6]);
+    lane_dirty(ls, vm->reg[R6] + 1);
+
+    if (status != VM_BUDGET)
+        lane_retire(ls, l, status);
+    else if (lane_get(ls, l) == -1)
+        lane_finish(ls, l);
+}
+
+/* Loads and stores. Memory is private to each lane; device and watched
+ * pages go through the interpreter. */
+static void lane_mem(lanes_t *ls, int l, uint16_t pc, uint16_t instr)
+{
+    VM *vm = ls->vm[l];
+    uint16_t op = instr >> 12, r = (instr >> 9) & 0x7, addr;
+
+    if (op == LDR || op == STR)
+        addr = ls->reg[(instr >> 6) & 0x7][l] + SEXT(instr & 0x3f, 6);
+    else
+        addr = pc + 1 + SEXT(instr & 0x1ff, 9);
+
+    if (op == LDI || op == STI)
+    {
+        if (vm->pflags[addr >> 8] & (PF_DEV | PF_WATCH))
+        {
+            lane_step(ls, l, pc);
+            return;
+        }
+        addr = MEM(vm, addr);
+    }
+
+    if (vm->pflags[addr >> 8] & (PF_DEV | PF_WATCH))
+        lane_step(ls, l, pc);
+    else if (op == ST || op == STR || op == STI)
+    {
+        mem_write(vm, addr, ls->reg[r][l]);
+        lane_dirty(ls, addr);
+    }
+    else
+        ls->reg[r][l] = ls->cc[l] = MEM(vm, addr);
+}
+
+/* Record the transfers the lanes in m made from pc */
+static void lane_edges(lanes_t *ls, uint16_t pc, uint16_t m)
+{
+    int l;
+
+    for (l = 0; l < LS_LANES; l++)
+        if ((m >> l) & 0x1)
+            COV_SET(ls->cov->edge, COV_EDGE(pc, ls->pc[l]));
+}
+
+/* Run the lanes until every one has retired */
+static void lockstep(lanes_t *ls)
+{
+    uint16_t pc, instr, op, m, x, r, a, imm;
+    int l, lead;
+
+    while (ls->live)
+    {
+        pc = v_min(ls->pc, ls->live);
+        m = v_eq(ls->pc, pc) & ls->live;
+
+        for (lead = 0; !((m >> lead) & 0x1); lead++)
+            ;
+        instr = MEM(ls->vm[lead], pc);
+
+        /* Lanes that may have rewritten this instruction run it on their
+         * own step if they did */
+        if ((ls->dirty[pc >> 3] >> (pc & 0x7)) & 0x1)
+            for (l = lead + 1; l < LS_LANES; l++)
+                if (((m >> l) & 0x1) && MEM(ls->vm[l], pc) != instr)
+                    m &= ~(1 << l);
+
+        /* Lanes out of steps sync with their machines, and retire once
+         * their budget is spent */
+        x = v_eq(ls->left, 0) & m;
+        for (l = 0; x; l++)
+        {
+            if (!((x >> l) & 0x1))
+                continue;
+            x &= ~(1 << l);
+            lane_put(ls, l);
+            lane_get(ls, l);
+            if (!ls->left[l])
+            {
+                m &= ~(1 << l);
+                lane_retire(ls, l, VM_BUDGET);
+            }
+        }
+
+        /* Lanes left behind too long run on alone */
+        v_addi(ls->wait, ls->wait, 1, ls->live & ~m);
+        v_set(ls->wait, 0, m);
+        x = v_eq(ls->wait, SPLIT_AFTER) & ls->live & ~m;
+        for (l = 0; x; l++)
+        {
+            if (!((x >> l) & 0x1))
+                continue;
+            x &= ~(1 << l);
+            lane_put(ls, l);
+            lane_finish(ls, l);
+        }
+
+        if (!m)
+            continue;
+        if (ls->cov)
+            COV_SET(ls->cov->addr, pc);
+        v_addi(ls->left, ls->left, 0xffff, m);
+        v_set(ls->pc, pc + 1, m);
+
+        op = instr >> 12;
+        r = (instr >> 9) & 0x7;
+        a = (instr >> 6) & 0x7;
+        switch (op)
+        {
+        case ADD:
+            if ((instr >> 5) & 0x1)
+                v_addi(ls->reg[r], ls->reg[a], SEXT(instr & 0x1f, 5), m);
+            else
+                v_add(ls->reg[r], ls->reg[a], ls->reg[instr & 0x7], m);
+            v_mov(ls->cc, ls->reg[r], m);
+            break;
+        case AND:
+            if ((instr >> 5) & 0x1)
+                v_andi(ls->reg[r], ls->reg[a], SEXT(instr & 0x1f, 5), m);
+            else
+                v_and(ls->reg[r], ls->reg[a], ls->reg[instr & 0x7], m);
+            v_mov(ls->cc, ls->reg[r], m);
+            break;
+        case NOT:
+            v_not(ls->reg[r], ls->reg[a], m);
+            v_mov(ls->cc, ls->reg[r], m);
+            break;
+        case LEA:
+            imm = pc + 1 + SEXT(instr & 0x1ff, 9);
+            v_set(ls->reg[r], imm, m);
+            v_set(ls->cc, imm, m);
+            break;
+        case BR:
+            v_set(ls->pc, pc + 1 + SEXT(instr & 0x1ff, 9),
+                  v_flags(ls->cc, r) & m);
+            if (ls->cov)
+                lane_edges(ls, pc, m);
+            break;
+        case JMP:
+            v_mov(ls->pc, ls->reg[a], m);
+            if (ls->cov)
+                lane_edges(ls, pc, m);
+            break;
+        case JSR:
+            /* JSRR R7 jumps to the old R7 */
+            if ((instr >> 11) & 0x1)
+                v_set(ls->pc, pc + 1 + SEXT(instr & 0x7ff, 11), m);
+            else
+                v_mov(ls->pc, ls->reg[a], m);
+            v_set(ls->reg[R7], pc + 1, m);
+            if (ls->cov)
+                lane_edges(ls, pc, m);
+            break;
+        case TRAP:
+            v_set(ls->reg[R7], pc + 1, m);
+            for (l = 0; l < LS_LANES; l++)
+                if ((m >> l) & 0x1)
+                    ls->pc[l] = MEM(ls->vm[l], instr & 0xff);
+            break;
+        case LD:
+        case LDI:
+        case LDR:
+        case ST:
+        case STI:
+        case STR:
+            for (l = 0; l < LS_LANES; l++)
+                if ((m >> l) & 0x1)
+                    lane_mem(ls, l, pc, instr);
+            break;
+        default:
+            for (l = 0; l < LS_LANES; l++)
+                if ((m >> l) & 0x1)
+                    lane_step(ls, l, pc);
+        }
+    }
+}
+
+/* Run every job on a clone of tmpl, LS_LANES at a time in lockstep. The
+ * results are the same as batch_run() would give. */
+void lockstep_run(const VM *tmpl, job_t *jobs, int njobs, uint64_t budget)
+{
+    lanes_t *ls = malloc(sizeof(*ls));
+    VM *vms = malloc(LS_LANES * sizeof(*vms));
+    int i, l;
+
+    if (!ls || !vms)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    ls->stop = budget ? tmpl->icount + budget : UINT64_MAX;
+    ls->cov = tmpl->cov;
+
+    for (i = 0; i < njobs; i += LS_LANES)
+    {
+        ls->live = 0;
+        memset(ls->wait, 0, sizeof(ls->wait));
+        memset(ls->dirty, 0, sizeof(ls->dirty));
+
+        for (l = 0; l < LS_LANES && i + l < njobs; l++)
+        {
+            ls->vm[l] = &vms[l];
+            ls->job[l] = &jobs[i + l];
+            ls->live |= 1 << l;
+
+            vm_clone(&vms[l], tmpl);
+            headless(&vms[l], jobs[i + l].in, jobs[i + l].inlen);
+            if (jobs[i + l].want)
+                grade(&vms[l], jobs[i + l].want, jobs[i + l].wantlen);
+            if (lane_get(ls, l) == -1)
+                lane_finish(ls, l);
+        }
+
+        lockstep(ls);
+    }
+
+    free(vms);
+    free(ls);
+}
@@ -0,0 +1,12 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "batch.h"
+#include "core.h"
+
+/* Machines that share one instruction stream */
+#define LS_LANES 16
+
+void lockstep_run(const VM *tmpl, job_t *jobs, int njobs, uint64_t budget);
+
+#endif
@@ -1,38 +1,119 @@
-#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
 
+#include "diag.h"
 #include "emit.h"
 #include "global.h"
 #include "panic.h"
 #include "parse.h"
 
-FILE *infile;
+void usage(void)
+{
+    fprintf(stderr, "Usage: lcas [-b] [-m] [-o object] [-s symbols] [file]\n");
+    exit(1);
+}
 
-void cleanup(void);
+/* path with its extension, if it has one, replaced by ext */
+void with_ext(char *dst, size_t size, const char *path, const char *ext)
+{
+    char *dot, *slash;
+
+    snprintf(dst, size, "%s", path);
+    dot = strrchr(dst, '.');
+    slash = strrchr(dst, '/');
+    if (dot && (!slash || dot > slash))
+        *dot = '\0';
+    strncat(dst, ext, size - strlen(dst) - 1);
+}
 
+/* Assemble a file, or stdin, as it is read. A file's object goes next to
+ * it unless -o says otherwise; stdin's, or -o -, goes to stdout. The
+ * symbol map goes next to the object, or to -s. Errors are all reported
+ * on stderr at the end, as JSON lines with -m, and no object is left. With
+ * -b the object is big-endian, as the standard LC-3 tools write it. */
 int main(int argc, char **argv)
 {
-    atexit(cleanup);
+    char *inpath = NULL, *objpath = NULL, *sympath = NULL;
+    char objbuf[4096], symbuf[4096];
+    FILE *out, *fp;
+    int i, machine = 0;
 
-    if (argc == 1)
+    for (i = 1; i < argc; i++)
     {
-        fprintf(stderr, "Usage: as <file>\n");
-        exit(1);
+        if (strcmp(argv[i], "-b") == 0)
+            emit_order = OBJ_BIG;
+        else if (strcmp(argv[i], "-m") == 0)
+            machine = 1;
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            objpath = argv[++i];
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            sympath = argv[++i];
+        else if (argv[i][0] == '-' && argv[i][1])
+            usage();
+        else if (!inpath)
+            inpath = argv[i];
+        else
+            usage();
     }
 
-    infile = fopen(argv[1], "r");
-    if (!infile)
-        panic("error: could not read file '%s'", argv[1]);
+    if (!inpath || strcmp(inpath, "-") == 0)
+        infile = stdin;
+    else
+    {
+        infile = fopen(inpath, "r");
+        if (!infile)
+            panic("error: could not read file '%s'", inpath);
+        srcpath = inpath;
+        if (!objpath)
+        {
+            with_ext(objbuf, sizeof(objbuf), inpath, ".lc3");
+            objpath = objbuf;
+        }
+    }
 
+    if (!objpath || strcmp(objpath, "-") == 0)
+        out = stdout;
+    else
+    {
+        out = fopen(objpath, "wb");
+        if (!out)
+            panic("emit: unable to open output file");
+        if (!sympath)
+        {
+            with_ext(symbuf, sizeof(symbuf), objpath, ".sym");
+            sympath = symbuf;
+        }
+    }
+
+    /* The listing would corrupt an object on stdout */
+    listing = out != stdout;
+
+    emit_begin(out);
     parse();
+    emit_end();
 
-    fclose(infile);
+    if (infile != stdin)
+        fclose(infile);
+    if (out != stdout && fclose(out) == EOF)
+        panic("emit: unable to write output file");
+
+    if (ndiags)
+    {
+        diag_report(stderr, infile == stdin ? "<stdin>" : inpath, machine);
+        if (out != stdout)
+            remove(objpath);
+        return 1;
+    }
 
-    emit();
+    if (sympath)
+    {
+        fp = fopen(sympath, "w");
+        if (!fp)
+            panic("emit: unable to open symbol file");
+        emit_symbols(fp);
+        fclose(fp);
+    }
 
     return 0;
 }
-
-void cleanup(void) { remove(DATAFILE); }
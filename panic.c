@@ -2,13 +2,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "panic.h"
+
+jmp_buf *panic_jmp;
+char panic_msg[256];
+
 void panic(char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
-    printf("fatal: ");
-    vprintf(fmt, ap);
-    printf("\n");
+    if (panic_jmp)
+    {
+        vsnprintf(panic_msg, sizeof(panic_msg), fmt, ap);
+        va_end(ap);
+        longjmp(*panic_jmp, 1);
+    }
+    /* stdout may be carrying an object */
+    fprintf(stderr, "fatal: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
     va_end(ap);
     exit(1);
 }
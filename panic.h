@@ -1,6 +1,13 @@
 #ifndef PANIC_H
 #define PANIC_H
 
+#include <setjmp.h>
+
+/* When set, panic() keeps its message in panic_msg and jumps here instead
+ * of exiting */
+extern jmp_buf *panic_jmp;
+extern char panic_msg[256];
+
 void panic(char *fmt, ...);
 
 #endif
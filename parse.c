@@ -1,30 +1,78 @@
-#include <fcntl.h>
+#include <setjmp.h>
 #include <stdarg.h>
-#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "diag.h"
 #include "directive.h"
+#include "emit.h"
+#include "expr.h"
 #include "global.h"
 #include "instr.h"
 #include "lex.h"
+#include "lexeme.h"
 #include "op.h"
 #include "panic.h"
 #include "parse.h"
+#include "preproc.h"
 #include "symbol.h"
 #include "token.h"
 
 /* Location counter */
 int lc;
 
-/* Output file descriptor */
-int ofd;
-
-/* Listing file descriptor */
-int lfd;
+/* Print each line as it is parsed */
+int listing = 1;
 
 int lookahead = NONE;
 
+/* Tokens read so far */
+static long ntokens;
+
+/* Where a syntax error abandons the line being parsed */
+static jmp_buf recover;
+
+/* Tokens read before the line being parsed, and where the last token read
+ * ends */
+static long linestart;
+static pos_t lastend;
+
 /* Advance the emitter */
-int advance() { return lookahead = lexan(); }
+int advance()
+{
+    ntokens++;
+    lastend = tokend;
+    return lookahead = preproc();
+}
+
+/* Report a syntax error at the lookahead, unless the lexer already has,
+ * and give up on the line. A line that ends too soon is reported where it
+ * ends. */
+void syntax_error(const char *expected)
+{
+    char what[64];
+    pos_t at = tokpos;
+
+    if (lookahead != ERROR)
+    {
+        if (ntokens > linestart && (tokbol || lookahead == DONE))
+        {
+            snprintf(what, sizeof(what), "unexpected end of %s",
+                     lookahead == DONE ? "file" : "line");
+            at = lastend;
+        }
+        else if (lookahead == DONE)
+            snprintf(what, sizeof(what), "unexpected end of file");
+        else
+            snprintf(what, sizeof(what), "unexpected '%s'",
+                     tokstr(lookahead, tokenval));
+        if (expected)
+            diag(at, "%s, expected '%s'", what, expected);
+        else
+            diag(at, "%s", what);
+    }
+    longjmp(recover, 1);
+}
 
 /* Match token and advance the parser */
 void match(int token)
@@ -32,23 +80,185 @@ void match(int token)
     if (lookahead == token)
         advance();
     else
-        panic("unexpected token '%s', expected '%s', line %d",
-              tokstr(lookahead, tokenval), tokstr(token, NONE), lineno);
+        syntax_error(tokstr(token, NONE));
+}
+
+/* The expression being parsed, and how deep in parentheses */
+static expr_t *ex;
+static int nesting;
+
+/* Add to the text of the expression */
+static void text(const char *s)
+{
+    size_t len = strlen(ex->text);
+
+    snprintf(ex->text + len, sizeof(ex->text) - len, "%s", s);
+}
+
+/* Add a step, written at at, to the expression. Defined symbols are put
+ * in by value, and an operator whose operands are known is applied there
+ * and then. */
+static void step(int op, int val, pos_t at)
+{
+    rpn_t *c = ex->code;
+    int unary = op == NEG || op == '~';
+
+    if (op == SYMBOL && symtable[val].defined)
+    {
+        op = NUMBER;
+        val = symtable[val].offset;
+    }
+    if (op != NUMBER && op != SYMBOL && c[ex->n - 1].op == NUMBER &&
+        (unary || c[ex->n - 2].op == NUMBER))
+    {
+        if (unary)
+            expr_apply(op, c[ex->n - 1].val, 0, &c[ex->n - 1].val);
+        else
+        {
+            ex->n--;
+            if (!expr_apply(op, c[ex->n - 1].val, c[ex->n].val,
+                            &c[ex->n - 1].val))
+                diag(at, "division by zero");
+        }
+        return;
+    }
+
+    if (ex->n == EXPRMAX)
+    {
+        diag(at, "expression too long");
+        longjmp(recover, 1);
+    }
+    c[ex->n].op = op;
+    c[ex->n].val = val;
+    ex->n++;
+}
+
+/* How tightly a binary operator binds, or 0 if the token is not one */
+static int binds(int token)
+{
+    switch (token)
+    {
+    case '|':
+        return 1;
+    case '^':
+        return 2;
+    case '&':
+        return 3;
+    case SHL:
+    case SHR:
+        return 4;
+    case '+':
+    case '-':
+        return 5;
+    case '*':
+    case '/':
+    case '%':
+        return 6;
+    }
+    return 0;
+}
+
+void binary(int prec);
+
+void primary()
+{
+    char num[16];
+
+    switch (lookahead)
+    {
+    case NUMBER:
+        snprintf(num, sizeof(num), "%d", tokenval);
+        text(num);
+        step(NUMBER, tokenval, tokpos);
+        advance();
+        break;
+    case SYMBOL:
+        text(symtable[tokenval].lexeme);
+        step(SYMBOL, tokenval, tokpos);
+        advance();
+        break;
+    case '(':
+        if (++nesting > EXPRMAX)
+        {
+            diag(tokpos, "expression too deeply nested");
+            longjmp(recover, 1);
+        }
+        text("(");
+        advance();
+        binary(1);
+        text(")");
+        match(')');
+        nesting--;
+        break;
+    default:
+        syntax_error("expression");
+    }
+}
+
+void unary()
+{
+    int op = lookahead;
+    pos_t at = tokpos;
+
+    if (op != '-' && op != '+' && op != '~')
+    {
+        primary();
+        return;
+    }
+    text(tokstr(op, NONE));
+    advance();
+    unary();
+    if (op != '+')
+        step(op == '-' ? NEG : op, 0, at);
 }
 
-void writeto(int fd, void *buf, size_t size)
+/* Operands joined by operators that bind at least as tightly as prec.
+ * Operators of equal precedence group to the left, as in C. */
+void binary(int prec)
 {
-    if (write(fd, buf, size) == -1)
-        panic("writeto: unable to write to file");
+    int op, p;
+    pos_t at;
+
+    unary();
+    while ((p = binds(lookahead)) >= prec)
+    {
+        op = lookahead;
+        at = tokpos;
+        text(tokstr(op, NONE));
+        advance();
+        binary(p + 1);
+        step(op, 0, at);
+    }
+}
+
+/* Parse the line's label or number operand, noting where it starts for
+ * the emitter. Return its value if it is known. */
+int operand(instr_t *instr)
+{
+    instr->argat = tokpos;
+    ex = &instr->expr;
+    nesting = 0;
+    binary(1);
+    return EXPR_KNOWN(ex) ? ex->code[0].val : 0;
 }
 
 void label(instr_t *instr)
 {
     instr->labelp = tokenval;
     match(SYMBOL);
-    if (symtable[instr->labelp].offset != -1)
-        panic("multiply defined label '%s'\n", symtable[instr->labelp].lexeme);
+    if (symtable[instr->labelp].defined)
+    {
+        diag(instr->at, "multiply defined label '%s'",
+             symtable[instr->labelp].lexeme);
+        return;
+    }
+
+    /* A constant gets its value from .EQU instead */
+    if (lookahead == DIRECTIVE && tokenval == EQU)
+        return;
     symtable[instr->labelp].offset = lc;
+    symtable[instr->labelp].defined = SYM_LABEL;
+    emit_label(instr->labelp);
 }
 
 void opadd(instr_t *instr)
@@ -68,9 +278,8 @@ void opadd(instr_t *instr)
     }
     else
     {
-        instr->arg3 = tokenval;
         instr->alt = 1;
-        match(NUMBER);
+        instr->arg3 = operand(instr);
     }
 }
 
@@ -91,16 +300,14 @@ void opand(instr_t *instr)
     }
     else
     {
-        instr->arg3 = tokenval;
         instr->alt = 1;
-        match(NUMBER);
+        instr->arg3 = operand(instr);
     }
 }
 
 void opbr(instr_t *instr)
 {
-    instr->arg1 = tokenval;
-    match(SYMBOL);
+    instr->arg1 = operand(instr);
 }
 
 void opjmp(instr_t *instr)
@@ -123,6 +330,7 @@ void opjsr(instr_t *instr)
 {
     op_t op = optable[instr->p];
 
+    instr->alt = op.attr;
     if (op.attr)
     {
         instr->arg1 = tokenval;
@@ -130,8 +338,7 @@ void opjsr(instr_t *instr)
     }
     else
     {
-        instr->arg1 = tokenval;
-        match(SYMBOL);
+        instr->arg1 = operand(instr);
     }
 }
 
@@ -140,8 +347,7 @@ void opld(instr_t *instr)
     instr->arg1 = tokenval;
     match(REG);
     match(COMMA);
-    instr->arg2 = tokenval;
-    match(SYMBOL);
+    instr->arg2 = operand(instr);
 }
 
 void opldi(instr_t *instr)
@@ -149,8 +355,7 @@ void opldi(instr_t *instr)
     instr->arg1 = tokenval;
     match(REG);
     match(COMMA);
-    instr->arg2 = tokenval;
-    match(SYMBOL);
+    instr->arg2 = operand(instr);
 }
 
 void opldr(instr_t *instr)
@@ -161,8 +366,7 @@ void opldr(instr_t *instr)
     instr->arg2 = tokenval;
     match(REG);
     match(COMMA);
-    instr->arg3 = tokenval;
-    match(NUMBER);
+    instr->arg3 = operand(instr);
 }
 
 void oplea(instr_t *instr)
@@ -170,8 +374,7 @@ void oplea(instr_t *instr)
     instr->arg1 = tokenval;
     match(REG);
     match(COMMA);
-    instr->arg2 = tokenval;
-    match(SYMBOL);
+    instr->arg2 = operand(instr);
 }
 
 void opnot(instr_t *instr)
@@ -188,8 +391,7 @@ void opst(instr_t *instr)
     instr->arg1 = tokenval;
     match(REG);
     match(COMMA);
-    instr->arg2 = tokenval;
-    match(SYMBOL);
+    instr->arg2 = operand(instr);
 }
 
 void opsti(instr_t *instr)
@@ -197,8 +399,7 @@ void opsti(instr_t *instr)
     instr->arg1 = tokenval;
     match(REG);
     match(COMMA);
-    instr->arg2 = tokenval;
-    match(SYMBOL);
+    instr->arg2 = operand(instr);
 }
 
 void opstr(instr_t *instr)
@@ -209,8 +410,7 @@ void opstr(instr_t *instr)
     instr->arg2 = tokenval;
     match(REG);
     match(COMMA);
-    instr->arg3 = tokenval;
-    match(NUMBER);
+    instr->arg3 = operand(instr);
 }
 
 void optrap(instr_t *instr)
@@ -218,8 +418,7 @@ void optrap(instr_t *instr)
     op_t op = optable[instr->p];
     if (!op.attr)
     {
-        instr->arg1 = tokenval;
-        match(NUMBER);
+        instr->arg1 = operand(instr);
     }
 }
 
@@ -278,9 +477,26 @@ void instruction(instr_t *instr)
     }
 }
 
+/* Give the line's label the value of its .EQU */
+void equ(instr_t *instr)
+{
+    int sym = instr->labelp;
+
+    if (sym == -1)
+    {
+        diag(instr->at, ".EQU needs a name");
+        return;
+    }
+    if (symtable[sym].defined)
+        return;
+    symtable[sym].offset = instr->arg1;
+    symtable[sym].defined = SYM_EQU;
+    emit_label(sym);
+}
+
 void directive(instr_t *instr)
 {
-    int p = tokenval;
+    int p = tokenval, sym;
     match(DIRECTIVE);
 
     instr->type = DIRECTIVE;
@@ -288,25 +504,57 @@ void directive(instr_t *instr)
 
     switch (p)
     {
-    case ORIG:
     case FILL:
+        instr->arg1 = operand(instr);
+        break;
+    case ORIG:
     case BLKW:
-        instr->arg1 = tokenval;
-        match(NUMBER);
+    case EQU:
+        /* These are needed on the spot, so cannot refer forward */
+        instr->arg1 = operand(instr);
+        if (!EXPR_KNOWN(&instr->expr) &&
+            expr_eval(instr->expr.code, instr->expr.n, &sym) == -1)
+            diag(instr->argat, "'%s' is not defined yet",
+                 symtable[sym].lexeme);
         break;
     case STRINGZ:
-        instr->arg1 = tokenval;
+        /* Taken now; reading on may lex another string over strval */
+        instr->arg1 = NONE;
+        if (lookahead == STRING)
+            strcpy(instr->str, strval);
         match(STRING);
         break;
     }
+
+    if (p == EQU)
+        equ(instr);
 }
 
 void line()
 {
     instr_t instr;
+    long start;
 
     instr.labelp = -1;
     instr.lc = lc;
+    instr.at = instr.argat = tokpos;
+    instr.expr.n = 0;
+    instr.expr.text[0] = '\0';
+    instr.str[0] = '\0';
+    start = linestart = ntokens;
+
+    /* After an error, resume at the next token to begin a line. The rest
+     * of the bad line is not worth reporting on. */
+    if (setjmp(recover))
+    {
+        quiet = 1;
+        if (ntokens == start)
+            advance();
+        while (lookahead != DONE && !tokbol)
+            advance();
+        quiet = 0;
+        return;
+    }
 
     if (lookahead == SYMBOL)
         label(&instr);
@@ -316,32 +564,47 @@ void line()
     else if (lookahead == DIRECTIVE)
         directive(&instr);
     else
-        panic("unexpected token %s, line %d", tokstr(lookahead, tokenval),
-              lineno);
-
-    instr_debug(&instr);
-
-    writeto(lfd, &instr, sizeof(instr));
-
-    ++lc;
+        syntax_error(NULL);
+
+    if (listing)
+        instr_debug(&instr);
+
+    emit_line(&instr);
+
+    /* Advance the location counter by the words the line occupies */
+    if (instr.type == OP)
+        ++lc;
+    else if (instr.p == ORIG)
+        lc = instr.arg1;
+    else if (instr.p == FILL)
+        ++lc;
+    else if (instr.p == BLKW)
+        lc += instr.arg1;
+    else if (instr.p == STRINGZ)
+        lc += strlen(instr.str) + 1;
 }
 
+/* Lines are assembled as they are read, and nothing after .END is. The
+ * main file may be read to its end while the tokens of a macro or an
+ * included file, or its own last line, are still to be parsed. */
 void program()
 {
-    while (!feof(infile))
+    while (lookahead != DONE && !done)
         line();
 }
 
 void parse()
 {
-    lfd = open(DATAFILE, O_WRONLY | O_CREAT, 0744);
-
-    if (lfd == -1)
-        panic("parse: unable to open '%s'", DATAFILE);
+    /* Start from a clean slate so that parse() can run again */
+    lc = 0;
+    lineno = 1;
+    colno = 0;
+    diag_reset();
+    lastsym = -1;
+    lastchar = 0;
 
-    lookahead = lexan();
+    preproc_begin();
+    lookahead = preproc();
 
     program();
-
-    close(lfd);
 }
@@ -1,12 +1,17 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include "instr.h"
+
 /* Parser lookahead token */
 extern int lookahead;
 
 /* Stores value of lookahead */
 extern int tokenval;
 
+/* Whether parse() prints each line */
+extern int listing;
+
 void parse(void);
 
 #endif
@@ -0,0 +1,556 @@
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "directive.h"
+#include "global.h"
+#include "lex.h"
+#include "panic.h"
+#include "parse.h"
+#include "preproc.h"
+#include "symbol.h"
+#include "token.h"
+
+/* Deepest nesting of macro expansions and of included files, and most
+ * parameters a macro can take */
+#define MAXDEPTH 64
+#define MAXPARAMS 16
+
+/* A token as it was lexed, kept to be read again */
+typedef struct tok_s
+{
+    int token;
+    int val;
+    pos_t at;
+    pos_t end; /* just past it */
+    int bol;   /* first on its line */
+    int depth; /* expansions it came out of */
+    char *str; /* text of a STRING */
+} tok_t;
+
+/* A growing run of tokens */
+typedef struct toks_s
+{
+    tok_t *t;
+    int n;
+    int cap;
+} toks_t;
+
+/* A macro. Its parameters appear in the body as PARAM tokens numbered
+ * from 0. */
+typedef struct macro_s
+{
+    int nparams;
+    toks_t body;
+} macro_t;
+
+/* A file that has been included, lexed once. The file being assembled is
+ * the first, with no tokens, so that it is not included into itself. */
+typedef struct incl_s
+{
+    char *real; /* canonical path, to tell if it was included already */
+    char *path; /* as it was opened, to find the files it includes */
+    int file;
+    toks_t toks;
+} incl_t;
+
+/* Tokens read in place of the lexer's: an included file's, or a macro
+ * expansion's, which belong to the stream and go with it */
+typedef struct stream_s
+{
+    tok_t *t;
+    int n;
+    int pos;
+    int owned;
+} stream_t;
+
+int tokbol;
+pos_t tokend;
+int included;
+const char *inclroot;
+
+static macro_t *macros;
+static int nmacros;
+static int macrocap;
+
+static incl_t *incls;
+static int nincls;
+static int inclcap;
+
+static stream_t streams[MAXDEPTH];
+static int nstreams;
+
+/* Where the last token came from: the stream numbered one less, or the
+ * lexer if 0. A token the lexer gave that is put back is held, to be read
+ * once there is nothing left in any stream. */
+static int from;
+static tok_t held;
+static int isheld;
+
+/* Line of the last token lexed, to tell which begin lines */
+static int lexline;
+
+/* Copies of the strings in kept tokens, freed with everything else */
+static char **strs;
+static int nstrs;
+static int strcap;
+
+static void *grow(void *p, int *cap, size_t size)
+{
+    p = realloc(p, (*cap ? 2 * *cap : 16) * size);
+    if (!p)
+        panic("preproc: out of memory");
+    *cap = *cap ? 2 * *cap : 16;
+    return p;
+}
+
+static char *keep_str(const char *s)
+{
+    if (nstrs == strcap)
+        strs = grow(strs, &strcap, sizeof(*strs));
+    strs[nstrs] = malloc(strlen(s) + 1);
+    if (!strs[nstrs])
+        panic("preproc: out of memory");
+    return strcpy(strs[nstrs++], s);
+}
+
+/* Append a token. A string still in the lexer's buffer is copied. */
+static void push_tok(toks_t *ts, const tok_t *t)
+{
+    if (ts->n == ts->cap)
+        ts->t = grow(ts->t, &ts->cap, sizeof(*ts->t));
+    ts->t[ts->n] = *t;
+    if (t->str == strval)
+        ts->t[ts->n].str = keep_str(strval);
+    ts->n++;
+}
+
+static void lex(tok_t *t)
+{
+    t->token = lexan();
+    t->val = tokenval;
+    t->at = tokpos;
+    t->end.file = tokpos.file;
+    t->end.line = lineno;
+    t->end.col = colno + 1;
+    t->bol = tokpos.line != lexline;
+    t->depth = 0;
+    t->str = t->token == STRING ? strval : NULL;
+    lexline = tokpos.line;
+}
+
+/* The next token, from the innermost stream that has one left, or else
+ * from the lexer */
+static void get(tok_t *t)
+{
+    stream_t *s;
+
+    while (nstreams)
+    {
+        s = &streams[nstreams - 1];
+        if (s->pos < s->n)
+        {
+            *t = s->t[s->pos++];
+            from = nstreams;
+            return;
+        }
+        if (s->owned)
+            free(s->t);
+        nstreams--;
+    }
+    from = 0;
+    if (isheld)
+    {
+        *t = held;
+        isheld = 0;
+        return;
+    }
+    lex(t);
+}
+
+/* Put back the last token read */
+static void unget(const tok_t *t)
+{
+    if (from)
+    {
+        streams[from - 1].pos--;
+        return;
+    }
+    held = *t;
+    if (t->str == strval)
+        held.str = keep_str(strval);
+    isheld = 1;
+}
+
+/* Pass over the rest of the line t is on */
+static void skip_line(tok_t *t)
+{
+    while (!t->bol && t->token != DONE)
+        get(t);
+    unget(t);
+}
+
+/* Read ts before anything else. at is what asked for it. */
+static void push(toks_t *ts, int owned, pos_t at)
+{
+    if (nstreams == MAXDEPTH)
+    {
+        diag(at, "macros and includes nested too deeply");
+        if (owned)
+            free(ts->t);
+        return;
+    }
+    if (!ts->n)
+    {
+        if (owned)
+            free(ts->t);
+        return;
+    }
+    streams[nstreams].t = ts->t;
+    streams[nstreams].n = ts->n;
+    streams[nstreams].pos = 0;
+    streams[nstreams].owned = owned;
+    nstreams++;
+}
+
+/* Record a macro, from its name after .MACRO through .ENDM. Names on the
+ * same line as the macro's are its parameters. The body is kept as
+ * tokens, so it is not lexed again each time it is used. */
+static void define(const tok_t *t)
+{
+    tok_t a;
+    int name = -1, params[MAXPARAMS], np = 0, ok = 1, i;
+    toks_t body = {0};
+
+    get(&a);
+    if (a.token == SYMBOL && !a.bol)
+    {
+        name = a.val;
+        get(&a);
+    }
+    else
+    {
+        if (a.token != ERROR)
+            diag(t->at, "expected a macro name");
+        ok = 0;
+    }
+
+    while (!a.bol && a.token != DONE)
+    {
+        if (a.token != SYMBOL || np == MAXPARAMS)
+        {
+            if (a.token != ERROR)
+                diag(a.at, a.token == SYMBOL ? "too many macro parameters"
+                                             : "expected a parameter name");
+            ok = 0;
+            while (!a.bol && a.token != DONE)
+                get(&a);
+            break;
+        }
+        params[np++] = a.val;
+        get(&a);
+        if (a.token == COMMA && !a.bol)
+            get(&a);
+    }
+
+    while (a.token != DIRECTIVE || a.val != ENDM)
+    {
+        if (a.token == DONE)
+        {
+            diag(t->at, "missing .ENDM");
+            unget(&a);
+            ok = 0;
+            break;
+        }
+        if (a.token == DIRECTIVE && a.val == MACRO)
+        {
+            diag(a.at, "macro definitions cannot nest");
+            ok = 0;
+        }
+        for (i = 0; a.token == SYMBOL && i < np; i++)
+            if (a.val == params[i])
+            {
+                a.token = PARAM;
+                a.val = i;
+            }
+        push_tok(&body, &a);
+        get(&a);
+    }
+
+    if (ok && symtable[name].macro != -1)
+    {
+        diag(t->at, "macro '%s' already defined", symtable[name].lexeme);
+        ok = 0;
+    }
+    if (!ok)
+    {
+        free(body.t);
+        return;
+    }
+
+    if (nmacros == macrocap)
+        macros = grow(macros, &macrocap, sizeof(*macros));
+    macros[nmacros].nparams = np;
+    macros[nmacros].body = body;
+    symtable[name].macro = nmacros++;
+}
+
+/* Replace a use of macro m, named by t, with its body. The arguments are
+ * the rest of the line, separated by commas, and stand in for the
+ * parameters token for token. Everything in the expansion is placed at
+ * the use, as that is where its errors will have to be fixed. */
+static void expand(const tok_t *t, const macro_t *m)
+{
+    tok_t a, b;
+    toks_t args = {0}, x = {0};
+    int start[MAXPARAMS + 1], nargs = 0, i, k;
+
+    get(&a);
+    while (!a.bol && a.token != DONE)
+    {
+        if (nargs == MAXPARAMS)
+        {
+            nargs++;
+            break;
+        }
+        start[nargs++] = args.n;
+        while (!a.bol && a.token != DONE && a.token != COMMA)
+        {
+            push_tok(&args, &a);
+            get(&a);
+        }
+        if (args.n == start[nargs - 1])
+        {
+            diag(a.at, "missing macro argument");
+            nargs = -1;
+            break;
+        }
+        if (a.token != COMMA || a.bol)
+            break;
+        get(&a);
+        if (a.bol || a.token == DONE)
+        {
+            diag(a.at, "missing macro argument");
+            nargs = -1;
+            break;
+        }
+    }
+    skip_line(&a);
+
+    if (nargs != -1 && nargs != m->nparams)
+        diag(t->at, "macro '%s' takes %d argument%s, not %s%d",
+             symtable[t->val].lexeme, m->nparams, m->nparams == 1 ? "" : "s",
+             nargs > MAXPARAMS ? "more than " : "",
+             nargs > MAXPARAMS ? MAXPARAMS : nargs);
+    if (nargs == m->nparams && t->depth == MAXDEPTH)
+        diag(t->at, "macro '%s' expands too deeply", symtable[t->val].lexeme);
+    if (nargs != m->nparams || t->depth == MAXDEPTH)
+    {
+        free(args.t);
+        return;
+    }
+    start[nargs] = args.n;
+
+    for (i = 0; i < m->body.n; i++)
+    {
+        b = m->body.t[i];
+        if (b.token != PARAM)
+        {
+            b.at = t->at;
+            b.end = t->end;
+            b.depth = t->depth + 1;
+            push_tok(&x, &b);
+            continue;
+        }
+        for (k = start[b.val]; k < start[b.val + 1]; k++)
+        {
+            a = args.t[k];
+            a.at = t->at;
+            a.end = t->end;
+            a.depth = t->depth + 1;
+            a.bol = k == start[b.val] && b.bol;
+            push_tok(&x, &a);
+        }
+    }
+    if (x.n)
+        x.t[0].bol = t->bol;
+    free(args.t);
+
+    push(&x, 1, t->at);
+}
+
+/* Whether the canonical path real is dir or under it */
+static int inside(const char *real, const char *dir)
+{
+    size_t n = strlen(dir);
+
+    if (n && dir[n - 1] == '/')
+        n--;
+    return strncmp(real, dir, n) == 0 && (!real[n] || real[n] == '/');
+}
+
+/* Include the file named after .INCLUDE, unless it has been already. A
+ * relative name is taken from the directory of the file that names it. */
+static void include(const tok_t *t)
+{
+    const char *from = NULL, *slash;
+    char *path, *real;
+    FILE *save, *fp;
+    int saveline, savecol, savefile, savelex, savequiet, i;
+    incl_t *in;
+    tok_t a;
+
+    get(&a);
+    if (a.token != STRING || a.bol)
+    {
+        if (a.token != ERROR)
+            diag(t->at, "expected a file name in quotes");
+        skip_line(&a);
+        return;
+    }
+
+    for (i = 0; i < nincls; i++)
+        if (incls[i].file == t->at.file)
+            from = incls[i].path;
+    if (!t->at.file)
+        from = srcpath;
+    slash = from && a.str[0] != '/' ? strrchr(from, '/') : NULL;
+    path = malloc((slash ? slash - from + 1 : 0) + strlen(a.str) + 1);
+    if (!path)
+        panic("preproc: out of memory");
+    sprintf(path, "%.*s%s", slash ? (int)(slash - from + 1) : 0,
+            slash ? from : "", a.str);
+
+    /* The file is opened by its resolved name, so that what was checked
+     * against the root is what is read */
+    real = realpath(path, NULL);
+    if (real && inclroot && !inside(real, inclroot))
+    {
+        diag(a.at, "'%s' is outside '%s'", path, inclroot);
+        free(real);
+        free(path);
+        return;
+    }
+    fp = real ? fopen(real, "r") : NULL;
+    if (!fp)
+    {
+        diag(a.at, "unable to open '%s'", path);
+        free(real);
+        free(path);
+        return;
+    }
+    for (i = 0; i < nincls; i++)
+        if (strcmp(incls[i].real, real) == 0)
+        {
+            fclose(fp);
+            free(real);
+            free(path);
+            return;
+        }
+
+    if (nincls == inclcap)
+        incls = grow(incls, &inclcap, sizeof(*incls));
+    in = &incls[nincls++];
+    memset(in, 0, sizeof(*in));
+    in->real = real;
+    in->path = path;
+    in->file = diag_file(path);
+    included++;
+
+    /* Lex the whole file now, and go back to where the lexer was */
+    save = infile;
+    saveline = lineno;
+    savecol = colno;
+    savefile = srcfile;
+    savelex = lexline;
+    savequiet = quiet;
+    infile = fp;
+    lineno = 1;
+    colno = 0;
+    srcfile = in->file;
+    lexline = 0;
+    quiet = 0;
+    for (lex(&a); a.token != DONE; lex(&a))
+        push_tok(&in->toks, &a);
+    infile = save;
+    lineno = saveline;
+    colno = savecol;
+    srcfile = savefile;
+    lexline = savelex;
+    quiet = savequiet;
+    fclose(fp);
+
+    push(&in->toks, 0, t->at);
+}
+
+static void publish(const tok_t *t)
+{
+    tokenval = t->val;
+    tokpos = t->at;
+    tokend = t->end;
+    tokbol = t->bol;
+    if (t->str && t->str != strval)
+        strcpy(strval, t->str);
+}
+
+/* Forget everything from the last assembly */
+void preproc_begin(void)
+{
+    int i;
+
+    for (i = 0; i < nmacros; i++)
+        free(macros[i].body.t);
+    for (i = 0; i < nincls; i++)
+    {
+        free(incls[i].real);
+        free(incls[i].path);
+        free(incls[i].toks.t);
+    }
+    while (nstreams)
+        if (streams[--nstreams].owned)
+            free(streams[nstreams].t);
+    while (nstrs)
+        free(strs[--nstrs]);
+    nmacros = nincls = 0;
+    isheld = 0;
+    lexline = 0;
+    srcfile = 0;
+    included = 0;
+
+    if (srcpath)
+    {
+        if (!inclcap)
+            incls = grow(incls, &inclcap, sizeof(*incls));
+        memset(incls, 0, sizeof(*incls));
+        incls[0].real = realpath(srcpath, NULL);
+        if (incls[0].real)
+            nincls = 1;
+    }
+}
+
+/* Return the next token for the parser, after taking out macro
+ * definitions and expanding uses, and reading in included files */
+int preproc(void)
+{
+    tok_t t;
+
+    for (;;)
+    {
+        get(&t);
+        if (t.token == DIRECTIVE && t.val == MACRO)
+            define(&t);
+        else if (t.token == DIRECTIVE && t.val == INCLUDE)
+            include(&t);
+        else if (t.token == DIRECTIVE && t.val == ENDM)
+            diag(t.at, ".ENDM without .MACRO");
+        else if (t.token == SYMBOL && symtable[t.val].macro != -1)
+            expand(&t, &macros[symtable[t.val].macro]);
+        else
+        {
+            publish(&t);
+            return t.token;
+        }
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef PREPROC_H
+#define PREPROC_H
+
+#include "diag.h"
+
+/* Set if the last token is the first on its line */
+extern int tokbol;
+
+/* Just past the last token's last character */
+extern pos_t tokend;
+
+/* Files included since preproc_begin() */
+extern int included;
+
+/* If set, the canonical directory every included file must be in */
+extern const char *inclroot;
+
+void preproc_begin(void);
+int preproc(void);
+
+#endif
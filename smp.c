@@ -0,0 +1,64 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "smp.h"
+
+/* One hart and where its thread leaves the result */
+typedef struct hart_s
+{
+    VM *vm;
+    uint64_t budget;
+    int status;
+} hart_t;
+
+static void *hart_main(void *arg)
+{
+    hart_t *h = arg;
+
+    h->status = run(h->vm, h->budget);
+    return NULL;
+}
+
+/* Run the harts set up by smp_boot(), one host thread each, until hart 0
+ * stops. The others halt then, as a machine stops when its boot hart
+ * does. Each hart's status goes in status[]; returns hart 0's, or
+ * the first exception another hart raised. */
+int smp_run(VM *harts, int n, uint64_t budget, int *status)
+{
+    pthread_t tid[MAXHARTS];
+    hart_t hart[MAXHARTS];
+    int i, started, result;
+
+    for (i = 0; i < n; i++)
+    {
+        hart[i].vm = &harts[i];
+        hart[i].budget = budget;
+    }
+
+    /* Hart 0 runs on the calling thread */
+    for (started = 1; started < n; started++)
+        if (pthread_create(&tid[started], NULL, hart_main, &hart[started]))
+            break;
+    hart_main(&hart[0]);
+
+    /* Stopping the clock is the one request no engine undoes */
+    for (i = 1; i < started; i++)
+        __atomic_store_n(harts[i].mcr, 0, __ATOMIC_RELEASE);
+    for (i = 1; i < started; i++)
+        pthread_join(tid[i], NULL);
+
+    /* Harts that never got a thread did not run */
+    for (i = started; i < n; i++)
+        hart[i].status = VM_STOP;
+
+    result = hart[0].status;
+    for (i = 0; i < n; i++)
+    {
+        status[i] = hart[i].status;
+        if (result == VM_HALT && status[i] != VM_HALT && status[i] != VM_STOP)
+            result = status[i];
+    }
+    return result;
+}
@@ -0,0 +1,13 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+#include "core.h"
+
+/* Harts per machine */
+#define MAXHARTS 16
+
+int smp_run(VM *harts, int n, uint64_t budget, int *status);
+
+#endif
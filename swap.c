@@ -0,0 +1,51 @@
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "swap.h"
+
+/* Byte order of this machine's words */
+int host_order(void)
+{
+    const uint16_t one = 1;
+    uint8_t b;
+
+    memcpy(&b, &one, 1);
+    return b ? OBJ_LITTLE : OBJ_BIG;
+}
+
+/* Swap the bytes of n words in place, a vector at a time, so an image in
+ * the other byte order costs one pass over it */
+void swap16(uint16_t *w, size_t n)
+{
+    size_t i = 0;
+
+#ifdef __AVX2__
+    const __m256i order = _mm256_setr_epi8(
+        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5,
+        4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    __m256i v;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        v = _mm256_loadu_si256((const __m256i *)(w + i));
+        _mm256_storeu_si256((__m256i *)(w + i),
+                            _mm256_shuffle_epi8(v, order));
+    }
+#endif
+#ifdef __SSE2__
+    __m128i u;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        u = _mm_loadu_si128((const __m128i *)(w + i));
+        _mm_storeu_si128((__m128i *)(w + i),
+                         _mm_or_si128(_mm_slli_epi16(u, 8),
+                                      _mm_srli_epi16(u, 8)));
+    }
+#endif
+    for (; i < n; i++)
+        w[i] = (uint16_t)(w[i] << 8 | w[i] >> 8);
+}
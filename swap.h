@@ -0,0 +1,16 @@
+#ifndef SWAP_H
+#define SWAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Object files hold 16-bit words in either byte order. Ours have always
+ * been little-endian; the standard LC-3 tools write big-endian. */
+#define OBJ_AUTO 0
+#define OBJ_LITTLE 1
+#define OBJ_BIG 2
+
+int host_order(void);
+void swap16(uint16_t *w, size_t n);
+
+#endif
@@ -28,6 +28,8 @@ int insert_sym(char *s, int offset)
 
     ++lastsym;
     symtable[lastsym].offset = offset;
+    symtable[lastsym].defined = 0;
+    symtable[lastsym].macro = -1;
 
     p = insert_lexeme(s);
     symtable[lastsym].lexeme = &lextable[p];
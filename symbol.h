@@ -1,14 +1,21 @@
 #ifndef SYMBOL_H
 #define SYMBOL_H
 
+/* How a symbol got its value, if it has one */
+#define SYM_LABEL 1
+#define SYM_EQU 2
+#define SYM_EXTERN 3 /* an address from outside the source */
+
 typedef struct sym_s
 {
     char *lexeme;
-    int offset;
+    int offset; /* address of a label, or value of a constant */
     int defined;
+    int macro; /* index into the macro table, or -1 */
 } sym_t;
 
 extern sym_t symtable[];
+extern int lastsym;
 
 int lookup_sym(char *s);
 int insert_sym(char *s, int offset);
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "symmap.h"
+
+static int byaddr(const void *a, const void *b)
+{
+    return (int)((const symdef_t *)a)->addr - ((const symdef_t *)b)->addr;
+}
+
+/* Load "label xADDR" lines. Returns -1 if the file cannot be read. */
+int symmap_load(symmap_t *m, const char *path)
+{
+    char name[SYMNAME];
+    unsigned addr;
+    int cap = 0;
+    symdef_t *p;
+    FILE *fp = fopen(path, "r");
+
+    m->sym = NULL;
+    m->n = 0;
+    if (!fp)
+        return -1;
+
+    while (fscanf(fp, "%31s x%x", name, &addr) == 2)
+    {
+        if (m->n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            p = realloc(m->sym, cap * sizeof(*p));
+            if (!p)
+                break;
+            m->sym = p;
+        }
+        strcpy(m->sym[m->n].name, name);
+        m->sym[m->n++].addr = addr;
+    }
+    fclose(fp);
+
+    qsort(m->sym, m->n, sizeof(*m->sym), byaddr);
+    return 0;
+}
+
+void symmap_free(symmap_t *m)
+{
+    free(m->sym);
+    m->sym = NULL;
+    m->n = 0;
+}
+
+/* Address of a label, or -1 */
+int symmap_addr(const symmap_t *m, const char *name)
+{
+    int i;
+    for (i = 0; i < m->n; i++)
+        if (strcmp(m->sym[i].name, name) == 0)
+            return m->sym[i].addr;
+    return -1;
+}
+
+/* Closest label at or below addr, or NULL */
+const symdef_t *symmap_near(const symmap_t *m, uint16_t addr)
+{
+    int lo = 0, hi = m->n - 1, mid;
+    const symdef_t *best = NULL;
+
+    while (lo <= hi)
+    {
+        mid = (lo + hi) / 2;
+        if (m->sym[mid].addr <= addr)
+        {
+            best = &m->sym[mid];
+            lo = mid + 1;
+        }
+        else
+            hi = mid - 1;
+    }
+    return best;
+}
@@ -0,0 +1,26 @@
+#ifndef SYMMAP_H
+#define SYMMAP_H
+
+#include <stdint.h>
+
+#define SYMNAME 32
+
+typedef struct symdef_s
+{
+    char name[SYMNAME];
+    uint16_t addr;
+} symdef_t;
+
+/* Symbol map written by the assembler, sorted by address */
+typedef struct symmap_s
+{
+    symdef_t *sym;
+    int n;
+} symmap_t;
+
+int symmap_load(symmap_t *m, const char *path);
+void symmap_free(symmap_t *m);
+int symmap_addr(const symmap_t *m, const char *name);
+const symdef_t *symmap_near(const symmap_t *m, uint16_t addr);
+
+#endif
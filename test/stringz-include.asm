@@ -0,0 +1,6 @@
+; A string followed by an .INCLUDE, whose file name is lexed as a string
+        .ORIG x3000
+S       .STRINGZ "abc"
+        .INCLUDE "stringz.inc"
+T       .FILL S
+        .END
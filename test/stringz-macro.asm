@@ -0,0 +1,9 @@
+; A string followed by a macro definition with a string in its body
+        .ORIG x3000
+S       .STRINGZ "abc"
+        .MACRO MSG
+        .STRINGZ "zzzzzzzz"
+        .ENDM
+T       .FILL S
+        MSG
+        .END
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "op.h"
+#include "timing.h"
+
+static const char *opname[16] = {"BR",  "ADD", "LD",  "ST",  "JSR", "AND",
+                                 "LDR", "STR", "RTI", "NOT", "LDI", "STI",
+                                 "JMP", "RES", "LEA", "TRAP"};
+
+/* One cycle an instruction, and a ten cycle trip to memory behind caches
+ * of 64 lines of 4 words */
+static void model_default(tmodel_t *m)
+{
+    int i;
+
+    for (i = 0; i < 16; i++)
+        m->base[i] = 1;
+    m->taken = 1;
+    m->hit = 0;
+    m->miss = 10;
+    m->icache.lines = 64;
+    m->icache.words = 4;
+    m->dcache = m->icache;
+}
+
+/* Read a model file. Each line sets one cost: an opcode's base cost
+ * ("LDI 2"), "taken", "hit" or "miss", or a cache's geometry as lines and
+ * words per line ("icache 64 4"). Anything after # is ignored. */
+static int model_load(tmodel_t *m, const char *path)
+{
+    char line[128], key[16], *hash;
+    int a, b, n, i, lineno = 0;
+    cache_t *c;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp)
+    {
+        fprintf(stderr, "unable to open '%s'\n", path);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if ((hash = strchr(line, '#')))
+            *hash = '\0';
+        n = sscanf(line, "%15s %d %d", key, &a, &b);
+        if (n < 1)
+            continue;
+
+        if (strcmp(key, "icache") == 0 || strcmp(key, "dcache") == 0)
+        {
+            c = key[0] == 'i' ? &m->icache : &m->dcache;
+            if (n != 3 || a < 0 || b < 1)
+                goto bad;
+            c->lines = a;
+            c->words = b;
+            continue;
+        }
+        if (n != 2 || a < 0)
+            goto bad;
+
+        if (strcmp(key, "taken") == 0)
+            m->taken = a;
+        else if (strcmp(key, "hit") == 0)
+            m->hit = a;
+        else if (strcmp(key, "miss") == 0)
+            m->miss = a;
+        else
+        {
+            for (i = 0; i < 16 && strcmp(key, opname[i]) != 0; i++)
+                ;
+            if (i == 16)
+                goto bad;
+            m->base[i] = a;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+
+bad:
+    fprintf(stderr, "%s:%d: bad model line\n", path, lineno);
+    fclose(fp);
+    return -1;
+}
+
+/* Set up t with the model in path, or the default one if path is NULL */
+int timing_init(timing_t *t, const char *model)
+{
+    memset(t, 0, sizeof(*t));
+    model_default(&t->m);
+    if (model && model_load(&t->m, model) == -1)
+        return -1;
+
+    t->m.icache.tag = calloc(t->m.icache.lines + 1, sizeof(uint32_t));
+    t->m.dcache.tag = calloc(t->m.dcache.lines + 1, sizeof(uint32_t));
+    t->rid = calloc(0x10000, sizeof(uint16_t));
+    if (!t->m.icache.tag || !t->m.dcache.tag || !t->rid)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return 0;
+}
+
+void timing_free(timing_t *t)
+{
+    free(t->m.icache.tag);
+    free(t->m.dcache.tag);
+    free(t->rt);
+    free(t->rid);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Cost of one access to addr through c, counted as a hit or a miss.
+ * Device registers bypass the cache and are not counted. */
+static int mem_cost(timing_t *t, cache_t *c, uint16_t addr, uint64_t *hit,
+                    uint64_t *miss)
+{
+    uint32_t line = addr / c->words, *tag;
+
+    if (addr >= DEVPAGE)
+        return t->m.miss;
+    if (!c->lines)
+    {
+        (*miss)++;
+        return t->m.miss;
+    }
+
+    tag = &c->tag[line % c->lines];
+    if (*tag == line + 1)
+    {
+        (*hit)++;
+        return t->m.hit;
+    }
+    *tag = line + 1;
+    (*miss)++;
+    return t->m.miss;
+}
+
+/* The routine entered at entry, created on its first call */
+static int routine(timing_t *t, uint16_t entry)
+{
+    tstat_t *p;
+
+    if (t->rid[entry])
+        return t->rid[entry] - 1;
+
+    if (t->nrt == t->rtcap)
+    {
+        p = realloc(t->rt, (t->rtcap ? 2 * t->rtcap : 64) * sizeof(*p));
+        if (!p)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        t->rt = p;
+        t->rtcap = t->rtcap ? 2 * t->rtcap : 64;
+    }
+    memset(&t->rt[t->nrt], 0, sizeof(t->rt[0]));
+    t->rt[t->nrt].entry = entry;
+    t->rid[entry] = ++t->nrt;
+    return t->nrt - 1;
+}
+
+static void call(timing_t *t, uint16_t entry, uint16_t ret)
+{
+    int r = routine(t, entry);
+
+    t->rt[r].calls++;
+    if (t->depth == TSTACK)
+        return;
+    t->stack[t->depth] = r;
+    t->ret[t->depth] = ret;
+    t->depth++;
+}
+
+/* Return to pc from whichever routine on the stack was called from there */
+static void leave(timing_t *t, uint16_t pc)
+{
+    int d;
+
+    for (d = t->depth - 1; d > 0; d--)
+        if (t->ret[d] == pc)
+        {
+            t->depth = d;
+            return;
+        }
+}
+
+static void add(tstat_t *s, const tstat_t *d)
+{
+    s->instrs += d->instrs;
+    s->cycles += d->cycles;
+    s->ihit += d->ihit;
+    s->imiss += d->imiss;
+    s->dhit += d->dhit;
+    s->dmiss += d->dmiss;
+}
+
+/* Charge one retired instruction to the running routine */
+static void retire(timing_t *t, const trec_t *r)
+{
+    tstat_t d = {0};
+    cache_t *dc = &t->m.dcache;
+    int op = r->instr >> 12;
+    uint16_t next = r->pc + 1, ptr = next + sext(r->instr & 0x1ff, 9);
+
+    d.instrs = 1;
+    d.cycles = t->m.base[op] +
+               mem_cost(t, &t->m.icache, r->pc, &d.ihit, &d.imiss);
+
+    switch (op)
+    {
+    case LD:
+    case LDR:
+    case ST:
+    case STR:
+    case TRAP:
+        d.cycles += mem_cost(t, dc, r->addr, &d.dhit, &d.dmiss);
+        break;
+    case LDI:
+    case STI:
+        d.cycles += mem_cost(t, dc, ptr, &d.dhit, &d.dmiss);
+        d.cycles += mem_cost(t, dc, r->addr, &d.dhit, &d.dmiss);
+        break;
+    case RTI:
+        /* The trace does not say where the stack was */
+        d.cycles += 2 * t->m.miss;
+        break;
+    }
+
+    switch (op)
+    {
+    case BR:
+    case JMP:
+    case JSR:
+    case TRAP:
+    case RTI:
+        if (r->val != next)
+            d.cycles += t->m.taken;
+    }
+
+    add(&t->total, &d);
+    add(&t->rt[t->stack[t->depth - 1]], &d);
+
+    if (op == JSR || op == TRAP)
+        call(t, r->val, next);
+    else if ((op == JMP && ((r->instr >> 6) & 0x7) == R7) || op == RTI)
+        leave(t, r->val);
+}
+
+/* Run vm on the interpreter under the timing model. The trace ring carries
+ * each retired instruction out to the model a ring at a time, so the
+ * engines themselves do no extra work. */
+int timing_run(VM *vm, timing_t *t, uint64_t budget)
+{
+    trace_t *saved = vm->trace, *tr = calloc(1, sizeof(*tr));
+    uint64_t start = vm->icount, left = budget, seen = 0;
+    int status;
+
+    if (!tr)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    /* The code we start in counts as a routine called once */
+    if (!t->depth)
+        call(t, vm->reg[PC], 0);
+
+    vm->trace = tr;
+    do
+    {
+        status = run(vm, budget && left < TRACE_LEN ? left : TRACE_LEN);
+        for (; seen < tr->n; seen++)
+            retire(t, &tr->rec[seen & (TRACE_LEN - 1)]);
+        left = budget - (vm->icount - start);
+    } while (status == VM_BUDGET && (!budget || left));
+    vm->trace = saved;
+
+    free(tr);
+    return status;
+}
@@ -0,0 +1,63 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+#include "core.h"
+
+/* Direct-mapped cache of lines words each; lines 0 means no cache */
+typedef struct cache_s
+{
+    int lines;
+    int words;
+    uint32_t *tag; /* line address plus one, 0 when empty */
+} cache_t;
+
+/* Cycle costs. Every instruction pays its base cost, one access to fetch it
+ * and one per data word it touches. An access costs hit cycles, or miss
+ * cycles when it misses or bypasses the cache. */
+typedef struct tmodel_s
+{
+    int base[16];
+    int taken; /* extra for a transfer of control */
+    int hit;
+    int miss;
+    cache_t icache;
+    cache_t dcache;
+} tmodel_t;
+
+/* Costs charged to one routine, or to the whole run */
+typedef struct tstat_s
+{
+    uint16_t entry;
+    uint64_t calls;
+    uint64_t instrs;
+    uint64_t cycles;
+    uint64_t ihit, imiss;
+    uint64_t dhit, dmiss;
+} tstat_t;
+
+/* Calls deeper than this are charged to the deepest routine tracked */
+#define TSTACK 256
+
+typedef struct timing_s
+{
+    tmodel_t m;
+    tstat_t total;
+
+    /* Routines by entry point; rid maps an address to its index plus one */
+    tstat_t *rt;
+    int nrt, rtcap;
+    uint16_t *rid;
+
+    /* Routines being run and where each returns to */
+    int stack[TSTACK];
+    uint16_t ret[TSTACK];
+    int depth;
+} timing_t;
+
+int timing_init(timing_t *t, const char *model);
+void timing_free(timing_t *t);
+int timing_run(VM *vm, timing_t *t, uint64_t budget);
+
+#endif
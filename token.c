@@ -1,28 +1,58 @@
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "directive.h"
+#include "op.h"
 #include "panic.h"
 #include "symbol.h"
 #include "token.h"
 
+/* A token as it was written, or the name of its kind if tokenval is
+ * NONE */
 char *tokstr(int token, int tokenval)
 {
+    static char buf[32];
+
     switch (token)
     {
     case NUMBER:
-        return "NUMBER";
+        if (tokenval == NONE)
+            return "NUMBER";
+        snprintf(buf, sizeof(buf), "%d", tokenval);
+        return buf;
     case OP:
-        return "OP";
+        return tokenval == NONE ? "OP" : optable[tokenval].mnemonic;
     case DIRECTIVE:
-        return "DIRECTIVE";
+        if (tokenval == NONE)
+            return "DIRECTIVE";
+        snprintf(buf, sizeof(buf), ".%s", dirtable[tokenval]);
+        return buf;
     case SYMBOL:
-        return tokenval > 0 ? symtable[tokenval].lexeme : "ID";
+        return tokenval >= 0 ? symtable[tokenval].lexeme : "ID";
     case REG:
-        return "REG";
+        if (tokenval == NONE)
+            return "REG";
+        snprintf(buf, sizeof(buf), "R%d", tokenval);
+        return buf;
     case COMMA:
         return ",";
+    case STRING:
+        return "STRING";
     case DONE:
         return "DONE";
+    case ERROR:
+        return "ERROR";
+    case SHL:
+        return "<<";
+    case SHR:
+        return ">>";
     default:
+        if (token > 0 && token < 256)
+        {
+            buf[0] = token;
+            buf[1] = '\0';
+            return buf;
+        }
         panic("lexeme: unknown token %d", token);
         return NULL;
     }
@@ -9,6 +9,12 @@
 #define COMMA 262
 #define STRING 263
 #define DONE 264
+#define ERROR 265 /* a malformed token, already reported */
+#define PARAM 266 /* a macro parameter, only in macro bodies */
+#define SHL 267
+#define SHR 268
+
+/* Other operators in expressions are their own characters */
 
 #define NONE -1
 
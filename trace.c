@@ -0,0 +1,30 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Write the ring to fd oldest record first. Only calls write(), so it is
+ * safe to use from a signal handler. */
+int trace_dump(const trace_t *t, int fd)
+{
+    thdr_t hdr;
+    uint64_t head;
+    size_t older, newer;
+
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.total = t->n;
+    hdr.count = t->n < TRACE_LEN ? t->n : TRACE_LEN;
+
+    /* Once the ring wraps the oldest record sits at the write position */
+    head = t->n & (TRACE_LEN - 1);
+    older = t->n < TRACE_LEN ? 0 : TRACE_LEN - head;
+    newer = t->n < TRACE_LEN ? t->n : head;
+
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+        return -1;
+    if (older && write(fd, &t->rec[head], older * sizeof(trec_t)) == -1)
+        return -1;
+    if (newer && write(fd, &t->rec[0], newer * sizeof(trec_t)) == -1)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Records kept in the ring, a power of two */
+#define TRACE_LEN 65536
+
+#define TRACE_MAGIC "LC3T"
+
+/* One retired instruction. val is the value written to a register or to
+ * memory, or the new PC for control transfers; addr is the data address
+ * touched, if any. */
+typedef struct trec_s
+{
+    uint16_t pc;
+    uint16_t instr;
+    uint16_t val;
+    uint16_t addr;
+} trec_t;
+
+typedef struct trace_s
+{
+    uint64_t n; /* records ever written */
+    trec_t rec[TRACE_LEN];
+} trace_t;
+
+/* Dump file header, followed by count records, oldest first */
+typedef struct thdr_s
+{
+    char magic[4];
+    uint32_t count;
+    uint64_t total;
+} thdr_t;
+
+int trace_dump(const trace_t *t, int fd);
+
+#endif